@@ -0,0 +1,415 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Offline analysis of a -tr or -trc trace.  The file is mapped and read
+// in place, one run at a time: the volley latency percentiles, a heatmap
+// of volley latency over time, how slow volleys cluster, and with
+// per-client columns which clients hold the volleys up and how far the
+// barrier's release skew spreads the fan-out.
+
+#include "incast.h"
+#include "utils.h"
+#include "trace.h"
+
+using namespace std;
+
+int windowMsec = 100;
+double slowPercentile = 99;
+int maxLag = 10;
+
+// heatmap columns are powers of two in usec
+const int HEATMAP_BUCKETS = 24;
+
+struct TraceRun
+{
+    const TraceRunHeader *header;
+    vector<const TraceBlockHeader*> blocks;
+};
+
+vector<TraceRun> parseTrace( const char *base, size_t size )
+{
+    vector<TraceRun> runs;
+    size_t pos = 0;
+
+    while( pos + sizeof(TraceBlockHeader) <= size )
+    {
+        const char *magic = base + pos;
+
+        if( memcmp( magic, TRACE_RUN_MAGIC, sizeof(TRACE_RUN_MAGIC) ) == 0 )
+        {
+            if( pos + sizeof(TraceRunHeader) > size )
+                break;
+
+            TraceRun r;
+            r.header = (const TraceRunHeader *) magic;
+            runs.push_back( r );
+            pos += sizeof(TraceRunHeader);
+        }
+        else if( !runs.empty() && (memcmp( magic, TRACE_BLOCK_MAGIC, sizeof(TRACE_BLOCK_MAGIC) ) == 0) )
+        {
+            const TraceBlockHeader *b = (const TraceBlockHeader *) magic;
+            const size_t len = traceBlockSize( *runs.back().header, b->volleys );
+
+            if( pos + len > size )
+                break;
+
+            runs.back().blocks.push_back( b );
+            pos += len;
+        }
+        else
+        {
+            fprintf(stderr, "trace corrupt at offset %llu\n", (unsigned __int64) pos);
+            exit(-1);
+        }
+    }
+
+    if( pos < size )
+    {
+        fprintf(stderr, "trace truncated at offset %llu, ignoring the rest\n", (unsigned __int64) pos);
+    }
+
+    return runs;
+}
+
+__int64 percentileOf( vector<__int64> sorted, double p )
+{
+    size_t k = min( sorted.size() - 1, (size_t) (p * sorted.size()) );
+    nth_element( sorted.begin(), sorted.begin() + k, sorted.end() );
+    return sorted[k];
+}
+
+int heatmapBucket( double usec )
+{
+    int b = 0;
+    while( (usec >= 2) && (b < HEATMAP_BUCKETS - 1) )
+    {
+        usec /= 2;
+        b++;
+    }
+    return b;
+}
+
+void analyzeLatency( const vector<__int64> &latency, double usec )
+{
+    printf( "\nVolley latency:\n" );
+    printf( "\tvolleys:              %10u\n", (unsigned) latency.size() );
+    printf( "\tmedian usec:          %10.3f\n", percentileOf( latency, 0.5 ) * usec );
+    printf( "\t90th usec:            %10.3f\n", percentileOf( latency, 0.9 ) * usec );
+    printf( "\t99th usec:            %10.3f\n", percentileOf( latency, 0.99 ) * usec );
+    printf( "\t99.9th usec:          %10.3f\n", percentileOf( latency, 0.999 ) * usec );
+    printf( "\tmax usec:             %10.3f\n", *max_element( latency.begin(), latency.end() ) * usec );
+}
+
+// volleys per window and latency bucket
+void analyzeHeatmap( const vector<__int64> &start, const vector<__int64> &latency, double usec, __int64 freq )
+{
+    const __int64 window = max( (__int64) 1, (__int64) windowMsec * freq / 1000 );
+    const __int64 first = start.front();
+
+    const size_t windows = (size_t) ((start.back() - first) / window) + 1;
+    vector<vector<int>> counts( windows, vector<int>( HEATMAP_BUCKETS, 0 ) );
+
+    int lo = HEATMAP_BUCKETS, hi = 0;
+
+    for( size_t v = 0; v < latency.size(); ++v )
+    {
+        const int b = heatmapBucket( latency[v] * usec );
+        counts[(size_t) ((start[v] - first) / window)][b]++;
+        lo = min( lo, b );
+        hi = max( hi, b );
+    }
+
+    printf( "\nVolleys per %d msec window by latency, usec from:\n", windowMsec );
+    printf( "\t%10s", "msec" );
+    for( int b = lo; b <= hi; ++b )
+        printf( " %7d", 1 << b );
+    printf( "\n" );
+
+    for( size_t w = 0; w < windows; ++w )
+    {
+        printf( "\t%10llu", (unsigned __int64) w * windowMsec );
+        for( int b = lo; b <= hi; ++b )
+            printf( " %7d", counts[w][b] );
+        printf( "\n" );
+    }
+}
+
+// autocorrelation of the slow volley indicator: near 0 when slow volleys
+// strike independently, positive when they come in bursts
+void analyzeSlowVolleys( const vector<__int64> &latency, double usec )
+{
+    const __int64 threshold = percentileOf( latency, slowPercentile / 100 );
+    const size_t n = latency.size();
+
+    vector<double> slow( n );
+    double mean = 0;
+
+    for( size_t v = 0; v < n; ++v )
+    {
+        slow[v] = (latency[v] > threshold) ? 1 : 0;
+        mean += slow[v];
+    }
+    const double count = mean;
+    mean /= n;
+
+    double variance = 0;
+    for( size_t v = 0; v < n; ++v )
+        variance += (slow[v] - mean) * (slow[v] - mean);
+
+    printf( "\nSlow volleys, above the %gth percentile:\n", slowPercentile );
+    printf( "\tthreshold usec:       %10.3f\n", threshold * usec );
+    printf( "\tslow volleys:         %10.0f\n", count );
+
+    if( variance == 0 )
+        return;
+
+    for( int lag = 1; (lag <= maxLag) && ((size_t) lag < n); ++lag )
+    {
+        double sum = 0;
+        for( size_t v = 0; v + lag < n; ++v )
+            sum += (slow[v] - mean) * (slow[v + lag] - mean);
+
+        printf( "\tautocorrelation lag %2d: %8.3f\n", lag, sum / variance );
+    }
+}
+
+// how often each client was the last fan-in of a volley
+void analyzeStragglers( const TraceRun &run, double usec )
+{
+    const int clients = run.header->clients;
+    vector<int> last( clients, 0 );
+    vector<vector<__int64>> latency( clients );
+    int volleys = 0;
+
+    for( auto b : run.blocks )
+    {
+        for( int v = 0; v < b->volleys; ++v )
+        {
+            int slowest = 0;
+            for( int c = 0; c < clients; ++c )
+            {
+                const __int64 stop = traceClientColumn( b, c, TRACE_STOP )[v];
+                latency[c].push_back( stop - traceClientColumn( b, c, TRACE_START )[v] );
+
+                if( stop > traceClientColumn( b, slowest, TRACE_STOP )[v] )
+                    slowest = c;
+            }
+            last[slowest]++;
+        }
+        volleys += b->volleys;
+    }
+
+    vector<int> order( clients );
+    for( int c = 0; c < clients; ++c )
+        order[c] = c;
+    sort( order.begin(), order.end(), [&]( int a, int b ) { return last[a] > last[b]; } );
+
+    printf( "\nLast fan-in of the volley, by client:\n" );
+    printf( "\t%8s %10s %12s %12s\n", "client", "% volleys", "median usec", "99th usec" );
+
+    for( int k = 0; k < min( clients, 10 ); ++k )
+    {
+        const int c = order[k];
+        printf( "\t%8d %9.1f%% %12.3f %12.3f\n", c, last[c] * 100.0 / volleys,
+            percentileOf( latency[c], 0.5 ) * usec, percentileOf( latency[c], 0.99 ) * usec );
+    }
+}
+
+// how long after the barrier's release the clients' fan-outs began,
+// and the volley latency without that spread
+void analyzeRelease( const TraceRun &run, double usec )
+{
+    const int clients = run.header->clients;
+    vector<__int64> skew, latency;
+
+    for( auto b : run.blocks )
+    {
+        const __int64 *release = traceColumn( b, TRACE_RELEASE );
+        const __int64 *stop = traceColumn( b, TRACE_STOP );
+
+        for( int v = 0; v < b->volleys; ++v )
+        {
+            __int64 last = release[v];
+            for( int c = 0; c < clients; ++c )
+                last = max( last, traceClientColumn( b, c, TRACE_START )[v] );
+
+            skew.push_back( last - release[v] );
+            latency.push_back( stop[v] - last );
+        }
+    }
+
+    printf( "\nBarrier release skew, usec after the release:\n" );
+    printf( "\tvolley max median:    %10.3f\n", percentileOf( skew, 0.5 ) * usec );
+    printf( "\tvolley max 99th:      %10.3f\n", percentileOf( skew, 0.99 ) * usec );
+    printf( "\tvolley max max:       %10.3f\n", *max_element( skew.begin(), skew.end() ) * usec );
+    printf( "\tmedian less skew:     %10.3f\n", percentileOf( latency, 0.5 ) * usec );
+    printf( "\t99th less skew:       %10.3f\n", percentileOf( latency, 0.99 ) * usec );
+}
+
+void analyzeRun( int n, const TraceRun &run )
+{
+    const TraceRunHeader &h = *run.header;
+    const double usec = 1.0e6 / h.freq;
+
+    vector<__int64> start, latency;
+
+    for( auto b : run.blocks )
+    {
+        const __int64 *s = traceColumn( b, TRACE_START );
+        const __int64 *e = traceColumn( b, TRACE_STOP );
+
+        for( int v = 0; v < b->volleys; ++v )
+        {
+            start.push_back( s[v] );
+            latency.push_back( e[v] - s[v] );
+        }
+    }
+
+    printf( "\nRun %d: %d clients, %d byte fan-out, %d byte fan-in\n",
+        n, h.clients, h.fo_msg_size, h.fi_msg_size );
+
+    if( latency.empty() )
+    {
+        printf( "\tno volleys\n" );
+        return;
+    }
+
+    analyzeLatency( latency, usec );
+    analyzeHeatmap( start, latency, usec, h.freq );
+    analyzeSlowVolleys( latency, usec );
+
+    if( h.flags & TRACE_PER_CLIENT )
+    {
+        analyzeStragglers( run, usec );
+        analyzeRelease( run, usec );
+    }
+}
+
+void usage()
+{
+    fprintf(stderr, "\
+INCAST ANALYZE: Reads a trace written with -tr or -trc.\n\
+\n\
+    ANALYZE.EXE <trace> <options>\n\
+\n\
+Available <options> and their default values:\n\
+    -w  MSEC   Heatmap window (%d)\n\
+    -p  PCT    Volleys above this percentile are slow (%g)\n\
+    -l  NUM    Autocorrelation of slow volleys up to this lag (%d)\n",
+    windowMsec, slowPercentile, maxLag );
+
+    exit(-1);
+}
+
+int __cdecl main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        usage();
+    }
+
+    for( int a = 2; a < argc; ++a )
+    {
+        if ((argv[a][0] != '-') && (argv[a][0] != '/'))
+        {
+            usage();
+        }
+
+        switch (argv[a][1])
+        {
+            case 'w':
+                a++;
+                windowMsec = atoi(argv[a]);
+                if( windowMsec <= 0 )
+                {
+                    fprintf(stderr, "-w parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            case 'p':
+                a++;
+                slowPercentile = atof(argv[a]);
+                if( (slowPercentile <= 0) || (slowPercentile >= 100) )
+                {
+                    fprintf(stderr, "-p parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            case 'l':
+                a++;
+                maxLag = atoi(argv[a]);
+                if( maxLag <= 0 )
+                {
+                    fprintf(stderr, "-l parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    HANDLE file = CreateFile( argv[1], GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( file == INVALID_HANDLE_VALUE )
+    {
+        fprintf(stderr, "could not open %s: %d\n", argv[1], GetLastError());
+        exit(-1);
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx( file, &size );
+
+    if( size.QuadPart == 0 )
+    {
+        printf( "%s is empty\n", argv[1] );
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMapping( file, NULL, PAGE_READONLY, 0, 0, NULL );
+    const char *base = mapping ? (const char *) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+    if( base == NULL )
+    {
+        fprintf(stderr, "could not map %s: %d\n", argv[1], GetLastError());
+        exit(-1);
+    }
+
+    vector<TraceRun> runs = parseTrace( base, (size_t) size.QuadPart );
+
+    printf( "%s: %u runs\n", argv[1], (unsigned) runs.size() );
+
+    for( unsigned r = 0; r < runs.size(); ++r )
+    {
+        analyzeRun( r + 1, runs[r] );
+    }
+
+    UnmapViewOfFile( base );
+    CloseHandle( mapping );
+    CloseHandle( file );
+}
@@ -0,0 +1,239 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_BACKGROUND_H
+#define _INCAST_BACKGROUND_H
+
+// Background elephant flows.  With -bg NUM the last NUM clients to connect
+// take no part in the volleys.  Each streams toward the server instead,
+// capped at gtp.background_mbps or as fast as it can, until every volley
+// of the measured phase is done.  The test then runs twice, without and
+// with the streams, so the two can be compared.
+//
+// A stream is made of BACKGROUND_CHUNK messages that start with a
+// BACKGROUND_DATA byte.  The server stops it with a single byte of its
+// own, and the client answers with a lone BACKGROUND_END byte, followed by
+// its results as usual.
+
+const int BACKGROUND_CHUNK = 64 * 1024;
+
+const char BACKGROUND_DATA = 'D';
+const char BACKGROUND_END = 'E';
+const char BACKGROUND_STOP = 'S';
+
+struct BackgroundFlow
+{
+    __int64 bytes;      // while the volleys ran
+    __int64 start;
+    __int64 stop;
+
+    BackgroundFlow()
+        : bytes(0)
+        , start(0)
+        , stop(0)
+    {};
+};
+
+struct BackgroundState
+{
+    std::vector<BackgroundFlow> flows;
+    volatile LONG volleying;    // serverThreads still in the measured phase
+
+    void reset()
+    {
+        flows.assign( gtp.background, BackgroundFlow() );
+        volleying = incastClients();
+    }
+} background;
+
+bool isBackgroundClient( int client_num )
+{
+    return client_num >= incastClients();
+}
+
+// serverThread, once it has run its last volley
+void backgroundVolleysDone()
+{
+    InterlockedDecrement( &background.volleying );
+}
+
+// serverThread for a background client
+void serverStream( SOCKET s, int client_num )
+{
+    BackgroundFlow &f = background.flows[client_num - incastClients()];
+    std::vector<char> buf( BACKGROUND_CHUNK );
+    int bytes;
+
+    // an idle run stops the stream before it starts
+    bool stopping = false;
+
+    while( true )
+    {
+        if( !stopping && (!gtp.background_on || (background.volleying == 0)) )
+        {
+            if ((bytes = send(s, &BACKGROUND_STOP, 1, 0)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "send() background stop failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == 1);
+            stopping = true;
+        }
+
+        if ((bytes = recv(s, buf.data(), 1, MSG_WAITALL)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() background stream failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == 1);
+
+        if( buf[0] == BACKGROUND_END )
+            break;
+
+        if ((bytes = recv(s, buf.data() + 1, BACKGROUND_CHUNK - 1, MSG_WAITALL)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() background stream failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == BACKGROUND_CHUNK - 1);
+
+        // what arrives after the stop was in flight already
+        if( !stopping )
+        {
+            if( f.start == 0 )
+                f.start = qpc();
+
+            f.bytes += BACKGROUND_CHUNK;
+            f.stop = qpc();
+        }
+    }
+}
+
+// clientMain for a background client
+void clientStream( SOCKET s )
+{
+    std::vector<char> buf( BACKGROUND_CHUNK, 0 );
+    buf[0] = BACKGROUND_DATA;
+
+    const double ticksPerByte = (gtp.background_mbps > 0) ?
+        8.0 * freq / (gtp.background_mbps * 1.0e6) : 0;
+
+    __int64 start = qpc();
+    __int64 sent = 0;
+    int bytes;
+
+    while( true )
+    {
+        // the stop is the only thing the server sends us
+        u_long pending = 0;
+        ioctlsocket( s, FIONREAD, &pending );
+
+        if( pending > 0 )
+        {
+            char stop;
+            if ((bytes = recv(s, &stop, 1, 0)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "recv() background stop failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == 1 && stop == BACKGROUND_STOP);
+            break;
+        }
+
+        if ((bytes = send(s, buf.data(), BACKGROUND_CHUNK, 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "send() background stream failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == BACKGROUND_CHUNK);
+
+        sent += BACKGROUND_CHUNK;
+
+        // a chunk takes milliseconds at any cap worth setting, so
+        // sleeping rather than spinning costs the volleys no CPU
+        while( qpc() < start + sent * ticksPerByte )
+        {
+            Sleep(1);
+        }
+    }
+
+    if ((bytes = send(s, &BACKGROUND_END, 1, 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() background end failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == 1);
+}
+
+// aggregate goodput, in mbit/sec; 0 for an idle run
+double backgroundGoodput()
+{
+    double mbps = 0;
+
+    for( auto &f : background.flows )
+    {
+        if( f.stop > f.start )
+            mbps += f.bytes * 8.0 / (((double) (f.stop - f.start)) / freq) / 1.0e6;
+    }
+
+    return mbps;
+}
+
+void reportBackground()
+{
+    if( !gtp.background_on )
+        return;
+
+    const int flows = (int) background.flows.size();
+    const double mbps = backgroundGoodput();
+
+    printf( "\nBackground flows:\n" );
+    printf( "\tflows:                %10d\n", flows );
+    if( gtp.background_mbps > 0 )
+        printf( "\tcap mbit/sec each:    %10d\n", gtp.background_mbps );
+    else
+        printf( "\tcap mbit/sec each:    %10s\n", "none" );
+    printf( "\tgoodput mbit/sec:     %10.3f\n", mbps );
+    printf( "\tgoodput avg per flow: %10.3f\n", mbps / flows );
+}
+
+void reportBackgroundComparison( const std::vector<TestSummary> &runs, const std::vector<double> &goodput )
+{
+    const char *load[] = { "none", "elephants" };
+
+    printf( "\nBackground load comparison:\n" );
+    printf( "\t%-10s %12s %12s %12s %12s %12s %12s\n",
+        "background", "median usec", "99th usec", "max usec", "iter/sec", "retransmits", "bg mbit/s" );
+
+    for( unsigned r = 0; r < runs.size(); ++r )
+    {
+        const TestSummary &t = runs[r];
+        printf( "\t%-10s %12.3f %12.3f %12.3f %12.3f %12d %12.3f\n",
+            load[r], t.median_usec, t.p99_usec, t.max_usec, t.iters_per_sec, t.retransmits, goodput[r] );
+    }
+}
+
+#endif // _INCAST_BACKGROUND_H
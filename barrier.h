@@ -34,7 +34,7 @@
 struct barrier
 {
     barrier( long count )
-        : threshold_(count), count_(count), generation_(0)
+        : threshold_(count), count_(count), generation_(0), released_(0)
     {
         InitializeCriticalSection(&cs_);
         InitializeConditionVariable(&cv_);
@@ -46,7 +46,19 @@ struct barrier
     long count_;
     long generation_;
 
+    // qpc when the last thread to arrive released the others, after its
+    // onRelease; a released thread can read it until it waits again
+    __int64 released_;
+
     void wait()
+    {
+        wait( []{} );
+    }
+
+    // the last thread to arrive runs onRelease before it releases the
+    // others, so onRelease sees everything they did before waiting
+    template< typename F >
+    void wait( F onRelease )
     {
         EnterCriticalSection(&cs_);
         
@@ -54,8 +66,14 @@ struct barrier
 
         if(--count_ == 0)
         {
+            onRelease();
             ++generation_;
             count_ = threshold_;
+
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            released_ = now.QuadPart;
+
             WakeAllConditionVariable(&cv_);
         } 
         else
@@ -0,0 +1,366 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+// Micro-benchmarks for the harness's own machinery: how long the barrier
+// takes to release its threads, what the histogram costs per sample, how
+// closely mySleep hits its target, and how long the latency report takes
+// to aggregate a large run.
+//
+// Results go to stdout as CSV, one row per benchmark, parameter and
+// metric, summarized over the repetitions:
+//
+//     benchmark,parameter,metric,unit,median,min,max
+
+#include "incast.h"
+#include "utils.h"
+#include "tcpstats.h"
+#include "histogram.h"
+#include "shuffle.h"
+#include "congestion.h"
+#include "report.h"
+
+#include <io.h>
+#include <random>
+
+using namespace std;
+
+int reps = 5;
+int maxBarrierThreads = 64;
+__int64 maxHistogramSamples = 100000000;
+
+void emit( const char *benchmark, __int64 parameter, const char *metric,
+    const char *unit, vector<double> values )
+{
+    sort( values.begin(), values.end() );
+
+    printf( "%s,%lld,%s,%s,%.3f,%.3f,%.3f\n",
+        benchmark, parameter, metric, unit,
+        values[values.size() / 2], values.front(), values.back() );
+    fflush( stdout );
+}
+
+//
+// barrier::wait
+//
+
+const int BARRIER_ROUNDS = 10000;
+
+struct BarrierBench
+{
+    barrier *b;
+    vector<__int64> released;   // [round * threads + thread]
+    int threads;
+};
+
+BarrierBench barrierBench;
+
+unsigned int __stdcall barrierThread( void *p )
+{
+    int t = (int) p;
+
+    for( int r = 0; r < BARRIER_ROUNDS; ++r )
+    {
+        barrierBench.b->wait();
+        barrierBench.released[r * barrierBench.threads + t] = qpc();
+    }
+
+    return 0;
+}
+
+void benchBarrier()
+{
+    for( int n = 2; n <= maxBarrierThreads; n *= 2 )
+    {
+        vector<double> skew, cost;
+
+        for( int rep = 0; rep < reps; ++rep )
+        {
+            barrier b( n );
+            barrierBench.b = &b;
+            barrierBench.threads = n;
+            barrierBench.released.assign( BARRIER_ROUNDS * n, 0 );
+
+            vector<HANDLE> threads;
+            __int64 start = qpc();
+
+            for( int t = 0; t < n; ++t )
+            {
+                threads.push_back( (HANDLE) _beginthreadex( NULL, 0, barrierThread, (void*) t, 0, NULL ) );
+            }
+            waitForThreads( threads );
+
+            __int64 elapsed = qpc() - start;
+
+            for( auto h : threads )
+                CloseHandle( h );
+
+            // release skew: first to last thread out of the same round
+            Histogram<__int64> h;
+            for( int r = 0; r < BARRIER_ROUNDS; ++r )
+            {
+                const __int64 *round = &barrierBench.released[r * n];
+                h.add( *max_element( round, round + n ) - *min_element( round, round + n ) );
+            }
+
+            skew.push_back( h.get_median() * 1.0e6 / freq );
+            cost.push_back( elapsed * 1.0e6 / freq / BARRIER_ROUNDS );
+        }
+
+        emit( "barrier_wait", n, "release_skew_median", "usec", skew );
+        emit( "barrier_wait", n, "round", "usec", cost );
+    }
+}
+
+//
+// Histogram
+//
+
+void benchHistogram()
+{
+    // volley latencies around 200 usec with a long tail, in qpc ticks
+    mt19937 rng( 1 );
+    lognormal_distribution<double> latency( log( 200.0e-6 * freq ), 0.5 );
+
+    for( __int64 n = 1000000; n <= maxHistogramSamples; n *= 10 )
+    {
+        vector<__int64> samples( (size_t) n );
+        for( auto &s : samples )
+            s = (__int64) latency( rng );
+
+        vector<double> add, percentile;
+
+        for( int rep = 0; rep < reps; ++rep )
+        {
+            Histogram<__int64> h;
+
+            __int64 start = qpc();
+            for( auto s : samples )
+                h.add( s );
+            add.push_back( (qpc() - start) * 1.0e9 / freq / n );
+
+            start = qpc();
+            volatile __int64 p99 = h.get_percentile( 0.99 );
+            percentile.push_back( qpc_to_msec( qpc() - start ) );
+        }
+
+        emit( "histogram_add", n, "per_sample", "nsec", add );
+        emit( "histogram_get_percentile", n, "call", "msec", percentile );
+    }
+}
+
+//
+// mySleep
+//
+
+const int SLEEP_SAMPLES = 50;
+
+void benchSleep()
+{
+    const double targets[] = { 0.5, 1, 2, 5, 10, 20 };
+
+    for( double target : targets )
+    {
+        vector<double> error;
+
+        for( int i = 0; i < SLEEP_SAMPLES; ++i )
+        {
+            __int64 actual = mySleep( target );
+            error.push_back( (qpc_to_msec( actual ) - target) * 1000 );
+        }
+
+        // the parameter is the target in usec
+        emit( "mysleep", (__int64) (target * 1000), "overshoot", "usec", error );
+    }
+}
+
+//
+// reportLatencyThroughput
+//
+
+void benchReport()
+{
+    const int sizes[][2] = { { 16, 100000 }, { 128, 100000 }, { 1024, 10000 } };
+
+    mt19937 rng( 1 );
+    uniform_int_distribution<__int64> latency( (__int64) (100.0e-6 * freq), (__int64) (300.0e-6 * freq) );
+
+    // the report prints; send that to NUL rather than into our CSV
+    int console = _dup( _fileno( stdout ) );
+
+    for( auto size : sizes )
+    {
+        const int clients = size[0];
+        gtp.clients = clients;
+        gtp.iters = size[1];
+
+        clientResults.clear();
+        clientResults.resize( clients );
+
+        __int64 volleyStart = 0;
+        for( int i = 0; i < gtp.iters; ++i )
+        {
+            __int64 volleyStop = volleyStart;
+            for( int c = 0; c < clients; ++c )
+            {
+                Measurement m;
+                m.actual_delay = 0;
+                m.start = volleyStart;
+                m.release = volleyStart;
+                m.stop = volleyStart + latency( rng );
+                volleyStop = max( volleyStop, m.stop );
+                clientResults[c].measurements.push_back( m );
+            }
+            volleyStart = volleyStop;
+        }
+
+        vector<double> elapsed;
+
+        for( int rep = 0; rep < reps; ++rep )
+        {
+            fflush( stdout );
+            freopen( "NUL", "w", stdout );
+
+            __int64 start = qpc();
+            reportLatencyThroughput();
+            elapsed.push_back( qpc_to_msec( qpc() - start ) );
+
+            fflush( stdout );
+            _dup2( console, _fileno( stdout ) );
+        }
+
+        emit( "report_latency_throughput", (__int64) clients * gtp.iters, "call", "msec", elapsed );
+    }
+
+    _close( console );
+    clientResults.clear();
+}
+
+void usage()
+{
+    fprintf(stderr, "\
+INCAST BENCH: Micro-benchmarks for the incast harness itself.\n\
+\n\
+    BENCH.EXE <options>\n\
+\n\
+Available <options> and their default values:\n\
+    -r  NUM    Repetitions of each benchmark (%d)\n\
+    -t  NUM    Largest barrier thread count, doubling from 2 (%d)\n\
+    -n  NUM    Largest histogram sample count, from 10^6 by 10x (%lld)\n\
+    -b  NAME   Run only barrier, histogram, sleep or report (all)\n",
+    reps, maxBarrierThreads, maxHistogramSamples );
+
+    exit(-1);
+}
+
+int __cdecl main( int argc, char** argv )
+{
+    setHighPriority();
+
+#ifndef _M_ARM
+    TIMECAPS tc;
+    HRESULT hr;
+    hr = timeGetDevCaps( &tc, sizeof(tc) );
+    HARD_ASSERT( hr == MMSYSERR_NOERROR);
+    hr = timeBeginPeriod( tc.wPeriodMin );
+    HARD_ASSERT( hr == TIMERR_NOERROR );
+#endif
+
+    const char *only = NULL;
+
+    for( int a = 1; a < argc; ++a )
+    {
+        if ((argv[a][0] != '-') && (argv[a][0] != '/'))
+        {
+            usage();
+        }
+
+        switch (argv[a][1])
+        {
+            case 'r':
+                a++;
+                reps = atoi(argv[a]);
+                if( reps <= 0 )
+                {
+                    fprintf(stderr, "-r parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            case 't':
+                a++;
+                maxBarrierThreads = atoi(argv[a]);
+                if( maxBarrierThreads < 2 )
+                {
+                    fprintf(stderr, "-t parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            case 'n':
+                a++;
+                maxHistogramSamples = _atoi64(argv[a]);
+                if( maxHistogramSamples < 1000000 )
+                {
+                    fprintf(stderr, "-n parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            case 'b':
+                a++;
+                only = argv[a];
+                if( strcmp( only, "barrier" ) && strcmp( only, "histogram" ) &&
+                    strcmp( only, "sleep" ) && strcmp( only, "report" ) )
+                {
+                    fprintf(stderr, "-b parameter invalid\n");
+                    exit(-1);
+                }
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    printf( "benchmark,parameter,metric,unit,median,min,max\n" );
+
+    if( !only || strcmp( only, "barrier" ) == 0 )
+        benchBarrier();
+
+    if( !only || strcmp( only, "histogram" ) == 0 )
+        benchHistogram();
+
+    if( !only || strcmp( only, "sleep" ) == 0 )
+        benchSleep();
+
+    if( !only || strcmp( only, "report" ) == 0 )
+        benchReport();
+
+#ifndef _M_ARM
+    hr = timeEndPeriod( tc.wPeriodMin );
+    HARD_ASSERT( hr == TIMERR_NOERROR );
+#endif
+}
@@ -0,0 +1,270 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_CHURN_H
+#define _INCAST_CHURN_H
+
+// Connection churn.  With -churn every measured fan-in comes back on a
+// new connection, the way an RPC client without connection reuse would
+// answer: the fan-out still goes down the test connection, then the
+// client connects to the churn port, sends a ChurnHeader and its fan-in,
+// and hangs up.  Volleys then run into the listen backlog, SYN handling
+// and slow start rather than a warmed-up congestion window.
+//
+// The churn listener has its own accept threads, one per volleying
+// client, each of which reads a whole fan-in and hands it to the waiting
+// serverThread.  Once it has read a connection the server resets it, so
+// neither side piles up TIME_WAIT connections over a long run.
+//
+// Warm-up stays on the test connections.
+
+const unsigned CHURN_PORT_OFFSET = 2000;
+
+struct ChurnHeader
+{
+    int client_num;
+    int iter;
+    int connect_usec;   // client side, including retries
+    int retries;        // refused or timed out connects
+};
+
+struct ChurnSlot
+{
+    HANDLE arrived;     // auto-reset, once the fan-in is in buf
+    std::vector<char> buf;
+    __int64 stop;
+    ChurnHeader header;
+};
+
+struct ChurnState
+{
+    SOCKET listener;
+    std::vector<HANDLE> threads;
+    std::vector<ChurnSlot> slots;
+    volatile bool stopping;
+} churn;
+
+unsigned churnPort()
+{
+    return basePort + CHURN_PORT_OFFSET;
+}
+
+unsigned int __stdcall churnThread( void * )
+{
+    int bytes;
+
+    while( true )
+    {
+        SOCKET cs;
+        if ((cs = accept(churn.listener, NULL, NULL)) == INVALID_SOCKET)
+        {
+            // churnStop closes the listener to stop us
+            if( churn.stopping )
+                break;
+
+            fprintf(stderr, "accept() churn failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        ChurnHeader h;
+        if ((bytes = recv(cs, (char*) &h, sizeof(h), MSG_WAITALL)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() churn header failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == sizeof(h));
+        HARD_ASSERT(h.client_num >= 0 && h.client_num < (int) churn.slots.size());
+
+        ChurnSlot &slot = churn.slots[h.client_num];
+        const int size = (int) slot.buf.size();
+
+        if ((bytes = recvMessage(cs, slot.buf.data(), size)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() churn fan-in failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == size);
+
+        slot.stop = qpc();
+        slot.header = h;
+
+        // reset rather than close, see above
+        LINGER l = { 1, 0 };
+        setsockopt( cs, SOL_SOCKET, SO_LINGER, (char*) &l, sizeof(l) );
+        closesocket( cs );
+
+        SetEvent( slot.arrived );
+    }
+
+    return 0;
+}
+
+// runTest, before the serverThreads start
+void churnStart()
+{
+    const int clients = incastClients();
+
+    churn.stopping = false;
+    churn.listener = createAuxListener( churnPort(), gtp.churn_backlog );
+
+    churn.slots.resize( clients );
+    for( auto &slot : churn.slots )
+    {
+        slot.arrived = CreateEvent( NULL, FALSE, FALSE, NULL );
+        slot.buf.resize( gtp.fi_msg_size );
+    }
+
+    for( int t = 0; t < clients; ++t )
+    {
+        churn.threads.push_back( (HANDLE) _beginthreadex( NULL, 0, churnThread, NULL, 0, NULL ) );
+    }
+}
+
+void churnStop()
+{
+    churn.stopping = true;
+    closesocket( churn.listener );
+
+    waitForThreads( churn.threads );
+
+    for( auto h : churn.threads )
+        CloseHandle( h );
+    for( auto &slot : churn.slots )
+        CloseHandle( slot.arrived );
+
+    churn.threads.clear();
+    churn.slots.clear();
+}
+
+// serverThread, in place of receiving the fan-in; returns the fan-in
+// and sets stop to when it was all in
+char *churnWait( int client_num, int iter, TestResult &tr, __int64 &stop )
+{
+    ChurnSlot &slot = churn.slots[client_num];
+
+    WaitForSingleObject( slot.arrived, INFINITE );
+    HARD_ASSERT(slot.header.iter == iter);
+
+    stop = slot.stop;
+    tr.churn_connect_usec.push_back( slot.header.connect_usec );
+    tr.churn_retries += slot.header.retries;
+
+    return slot.buf.data();
+}
+
+// clientMain, in place of sending the fan-in on the test connection
+void clientChurnFanIn( SOCKADDR_INET server, int client_num, int iter, char *buf, int len )
+{
+    SOCKET cs;
+    int bytes;
+
+    setAddressPort( server, churnPort() );
+
+    ChurnHeader h;
+    h.client_num = client_num;
+    h.iter = iter;
+    h.retries = 0;
+
+    __int64 start = qpc();
+
+    while( true )
+    {
+        if ((cs = socket(server.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+        {
+            fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        applySocketOptions(cs);
+        bindSourceAddress(cs);
+
+        if (connect(cs, (SOCKADDR*) &server, addressLength(server)) != SOCKET_ERROR)
+            break;
+
+        // a full backlog refuses us; try again right away, like a
+        // client library would
+        int err = WSAGetLastError();
+        closesocket(cs);
+
+        if( (err != WSAECONNREFUSED) && (err != WSAETIMEDOUT) )
+        {
+            fprintf(stderr, "connect() churn failed: %d\n", err);
+            exit(-1);
+        }
+
+        h.retries++;
+    }
+
+    h.connect_usec = (int) ((qpc() - start) * 1.0e6 / freq);
+
+    WSABUF wb[2] = { { sizeof(h), (char*) &h }, { (ULONG) len, buf } };
+    DWORD sent;
+
+    if (WSASend(cs, wb, 2, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() churn fan-in failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(sent == sizeof(h) + len);
+
+    // wait for the server's reset, so the fan-in is known delivered
+    char junk;
+    recv( cs, &junk, 1, 0 );
+    closesocket( cs );
+}
+
+void reportChurn()
+{
+    if( !gtp.churn )
+        return;
+
+    Histogram<int> connect;
+    int retries = 0;
+
+    for( auto &tr : clientResults )
+    {
+        for( auto usec : tr.churn_connect_usec )
+            connect.add( usec );
+
+        retries += tr.churn_retries;
+    }
+
+    printf( "\nConnection churn (backlog %d):\n", gtp.churn_backlog );
+    printf( "\tconnections:          %10d\n", (int) connect.get_sample_size() );
+    printf( "\tmedian connect usec:  %10.3f\n", (double) connect.get_median() );
+    printf( "\t99th %%ile connect:    %10.3f\n", (double) connect.get_percentile(0.99) );
+    printf( "\tmaximum connect usec: %10.3f\n", (double) connect.get_max() );
+    printf( "\tclient retries:       %10d\n", retries );
+
+    // the server host's view; a refused SYN from a full backlog shows up
+    // as a failed attempt on the client instead
+    printf( "\tserver passive opens: %10d\n",
+        (int) (tcpStatsAfter.dwPassiveOpens - tcpStatsBefore.dwPassiveOpens) );
+    printf( "\tserver attempt fails: %10d\n",
+        (int) (tcpStatsAfter.dwAttemptFails - tcpStatsBefore.dwAttemptFails) );
+}
+
+#endif // _INCAST_CHURN_H
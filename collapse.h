@@ -0,0 +1,125 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_COLLAPSE_H
+#define _INCAST_COLLAPSE_H
+
+// Incast collapse search.  With -xc the fan-in size stays at -i and the
+// search is over how many of the connected clients volley; with -xi the
+// clients stay and the search is over the fan-in size, from -i up to a
+// maximum.  Clients left out of a run sit it out the way idle -bg
+// clients do, so every run reuses the same clients.
+//
+// A run has collapsed when its goodput is below -xf of the line rate, or
+// of the best goodput of any smaller run if that is lower, since a few
+// clients cannot fill the link.  It has also collapsed when its 99th
+// percentile is more than COLLAPSE_JUMP times the smallest run's, scaled
+// by the bytes a volley carries.  The search brackets the
+// threshold between a healthy and a collapsed run and bisects it, over
+// clients one by one or over sizes geometrically, and every run it makes
+// is a point on the reported curve.
+
+const double COLLAPSE_JUMP = 4;
+const double COLLAPSE_SIZE_RESOLUTION = 1.0625;
+
+struct CollapsePoint
+{
+    int clients;
+    int size;
+    TestSummary summary;
+    bool collapsed;         // as the search judged it; the base point never is
+};
+
+std::vector<CollapsePoint> collapsePoints;
+
+bool collapseBySize()
+{
+    return gtp.collapse_max_size > 0;
+}
+
+__int64 volleyBytes( const CollapsePoint &p )
+{
+    return (__int64) p.clients * p.size;
+}
+
+// against the smallest point and the best goodput up to this one
+bool isCollapsed( const CollapsePoint &p, const CollapsePoint &base )
+{
+    double peak = 0;
+    for( auto &q : collapsePoints )
+    {
+        if( volleyBytes( q ) <= volleyBytes( p ) )
+            peak = std::max( peak, q.summary.recv_mbps );
+    }
+
+    if( p.summary.recv_mbps < gtp.collapse_fraction * std::min( peak, (double) gtp.collapse_line_mbps ) )
+        return true;
+
+    const double scale = ((double) volleyBytes( p )) / volleyBytes( base );
+
+    return p.summary.p99_usec > COLLAPSE_JUMP * base.summary.p99_usec * scale;
+}
+
+void reportCollapse( int lo, int hi, bool collapsed )
+{
+    std::vector<CollapsePoint> curve( collapsePoints );
+    std::sort( curve.begin(), curve.end(),
+        []( const CollapsePoint &a, const CollapsePoint &b )
+        { return (a.clients < b.clients) || ((a.clients == b.clients) && (a.size < b.size)); } );
+
+    const char *unit = collapseBySize() ? "byte fan-in" : "clients";
+
+    printf( "\nIncast collapse curve:\n" );
+    printf( "\tline rate mbit/sec:   %10d\n", gtp.collapse_line_mbps );
+    printf( "\tgoodput floor:        %9.0f%%\n", gtp.collapse_fraction * 100 );
+    printf( "\tor 99th per byte at:  %9.0fx\n", COLLAPSE_JUMP );
+    printf( "\n" );
+    printf( "\t%8s %10s %12s %12s %12s %8s %10s\n",
+        "clients", "fan-in", "median usec", "99th usec", "mbit/s recv", "% line", "collapsed" );
+
+    for( auto &p : curve )
+    {
+        printf( "\t%8d %10d %12.3f %12.3f %12.3f %7.1f%% %10s\n",
+            p.clients, p.size, p.summary.median_usec, p.summary.p99_usec, p.summary.recv_mbps,
+            p.summary.recv_mbps * 100 / gtp.collapse_line_mbps,
+            p.collapsed ? "yes" : "no" );
+    }
+
+    if( !collapsed )
+        printf( "\tno collapse up to %d %s\n", hi, unit );
+    else
+        printf( "\tcollapse between %d and %d %s\n", lo, hi, unit );
+}
+
+bool collapseNarrow( int lo, int hi )
+{
+    if( collapseBySize() )
+        return (hi - lo <= 1) || (hi <= lo * COLLAPSE_SIZE_RESOLUTION);
+
+    return hi - lo <= 1;
+}
+
+#endif // _INCAST_COLLAPSE_H
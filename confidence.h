@@ -0,0 +1,175 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_CONFIDENCE_H
+#define _INCAST_CONFIDENCE_H
+
+// Confidence intervals for latency percentiles, and stopping a run once
+// the one we care about is known well enough.
+//
+// The interval for the p-th percentile of n volleys comes from order
+// statistics: the rank of the true percentile among the samples is
+// binomial(n, p), so with the normal approximation the 95% interval
+// runs from the sample at rank np - 1.96 sqrt(np(1-p)) to the one at
+// np + 1.96 sqrt(np(1-p)).  That holds whatever the latency distribution
+// looks like, as long as volleys are roughly independent.
+//
+// With -cs the server checks the interval every CONVERGE_INTERVAL volleys
+// and stops once its width is within gtp.converge_width of the estimate;
+// gtp.iters is then the budget.  Clients learn the outcome from a
+// CONVERGE_CONTINUE byte sent with the fan-out of each checked volley, or
+// a lone CONVERGE_STOP byte in its place.
+
+const int CONVERGE_INTERVAL = 1000;
+const double CONFIDENCE_Z = 1.96;
+
+const char CONVERGE_CONTINUE = 'C';
+const char CONVERGE_STOP = 'S';
+
+struct PercentileInterval
+{
+    double estimate;    // usec
+    double lower;
+    double upper;
+
+    double relativeWidth() const
+    {
+        return (upper - lower) / estimate;
+    }
+};
+
+// reorders samples, which are volley latencies in qpc ticks
+PercentileInterval percentileInterval( std::vector<__int64> &samples, double p )
+{
+    using namespace std;
+
+    const double n = (double) samples.size();
+    const double spread = CONFIDENCE_Z * sqrt( n * p * (1 - p) );
+
+    // same rank convention as Histogram::get_percentile
+    auto at = [&]( double rank ) -> double
+    {
+        size_t k = (size_t) max( 0.0, min( n - 1, ceil( rank ) - 1 ) );
+        nth_element( samples.begin(), samples.begin() + k, samples.end() );
+        return samples[k] * 1.0e6 / freq;
+    };
+
+    PercentileInterval pi;
+    pi.estimate = at( n * p );
+    pi.lower = at( n * p - spread );
+    pi.upper = at( n * p + spread );
+    return pi;
+}
+
+// volley latencies, first start to last stop, from the measurements
+// taken so far
+void appendVolleyLatencies( std::vector<__int64> &latency )
+{
+    const size_t volleys = clientResults[0].measurements.size();
+
+    for( size_t i = latency.size(); i < volleys; ++i )
+    {
+        __int64 firstStart = std::numeric_limits<__int64>::max();
+        __int64 lastStop = std::numeric_limits<__int64>::min();
+
+        for( int c = 0; c < incastClients(); ++c )
+        {
+            const Measurements &m = clientResults[c].measurements;
+            firstStart = std::min( firstStart, m[i].start );
+            lastStop = std::max( lastStop, m[i].stop );
+        }
+
+        latency.push_back( lastStop - firstStart );
+    }
+}
+
+struct ConvergenceState
+{
+    std::vector<__int64> latency;   // in volley order
+    std::vector<__int64> scratch;
+    PercentileInterval last;
+    bool converged;
+
+    void reset()
+    {
+        latency.clear();
+        converged = false;
+    }
+} convergence;
+
+// run by the last serverThread to reach the barrier before a checked
+// volley, while the others wait
+void convergenceCheck()
+{
+    appendVolleyLatencies( convergence.latency );
+
+    convergence.scratch = convergence.latency;
+    convergence.last = percentileInterval( convergence.scratch, gtp.converge_percentile / 100.0 );
+    convergence.converged = (convergence.last.relativeWidth() <= gtp.converge_width);
+}
+
+void reportConfidence()
+{
+    if( !gtp.confidence )
+        return;
+
+    // reportLatencyThroughput has already taken out any delay, so these
+    // are exclusive latencies when there was one
+    std::vector<__int64> latency;
+    appendVolleyLatencies( latency );
+
+    printf( "\nConfidence intervals (95%%, order statistics):\n" );
+
+    const struct { const char *label; double p; } rows[] =
+    {
+        { "median usec/iter:     ", 0.50 },
+        { "95th %ile usec/iter:  ", 0.95 },
+        { "99th %ile usec/iter:  ", 0.99 },
+    };
+
+    for( auto &r : rows )
+    {
+        PercentileInterval pi = percentileInterval( latency, r.p );
+        printf( "\t%s%10.3f [%.3f, %.3f] width %.1f%%\n",
+            r.label, pi.estimate, pi.lower, pi.upper, 100 * pi.relativeWidth() );
+    }
+
+    if( gtp.converge_percentile > 0 )
+    {
+        if( convergence.converged )
+        {
+            printf( "\tconverged:            %10d volleys, %dth %%ile within %.1f%%\n",
+                (int) latency.size(), gtp.converge_percentile, 100 * gtp.converge_width );
+        }
+        else
+        {
+            printf( "\tconverged:            %10s (budget of %d volleys used up)\n",
+                "no", (int) latency.size() );
+        }
+    }
+}
+
+#endif // _INCAST_CONFIDENCE_H
@@ -0,0 +1,466 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_CONGESTION_H
+#define _INCAST_CONGESTION_H
+
+// Congestion control selection.
+//
+// Windows has no per-socket TCP_CONGESTION.  A connection gets its
+// congestion provider from the TCP setting template that applies to it
+// when it is set up, so we point a custom template at the test's ports
+// with a transport filter: on the server for its listen ports, on a
+// client for the server port it connects to.  That takes an elevated
+// prompt, and because templates belong to the host, clients sharing a
+// host share an algorithm.
+//
+// The template is persistent, so we note its provider before the first
+// change and put it back along with the filter, on exit or CTRL-C.  Only
+// one incast process per host may use it: whoever gets there second
+// would overwrite the other's setting, so it refuses to run instead.
+// The filters cover the test ports only, which is why -cc and -cmp
+// can't be combined with -churn or -st.
+//
+// A client that has to change its setting only picks it up on its next
+// connection, so it says so after receiving its parameters, and then
+// every client reconnects before the run starts:
+//
+//     server                  client
+//     gtp, cstp         -->
+//                       <--   READY, CHANGED, FAILED or SHARED
+//     GO or AGAIN       -->   (not sent to CHANGED clients, which
+//                              have already hung up)
+
+const char * const CONGESTION_TEMPLATE = "InternetCustom";
+
+const char CONGESTION_READY = 'R';
+const char CONGESTION_CHANGED = 'C';
+const char CONGESTION_FAILED = 'F';     // client stays on the system default
+const char CONGESTION_SHARED = 'S';     // another incast process has the host's template
+const char CONGESTION_GO = 'G';
+const char CONGESTION_AGAIN = 'A';
+
+struct CongestionAlgorithm
+{
+    const char *name;
+    const char *provider;   // NULL for the system default
+};
+
+const CongestionAlgorithm congestionAlgorithms[] =
+{
+    { "default", NULL },
+    { "cubic", "CUBIC" },
+    { "dctcp", "DCTCP" },
+    { "ctcp", "CTCP" },
+    { "newreno", "NewReno" },
+    { "bbr2", "BBR2" },
+};
+
+struct CongestionState
+{
+    std::vector<std::string> mix;       // assigned round robin to clients
+    std::vector<std::string> compare;   // one run per algorithm
+
+    volatile LONG reconnect;            // a client changed its setting
+
+    // the transport filter we added, if any
+    bool filtered;
+    bool local;
+    unsigned first;
+    unsigned last;
+
+    // the template's provider before we first changed it
+    std::string original;
+
+    HANDLE owner;       // this host's template is ours while we hold it
+
+    CongestionState()
+        : reconnect(0)
+        , filtered(false)
+        , owner(NULL)
+    {};
+} ccState;
+
+bool isCongestionAlgorithm( const std::string &name )
+{
+    for( auto &a : congestionAlgorithms )
+    {
+        if( name == a.name )
+            return true;
+    }
+
+    return false;
+}
+
+const char *congestionProvider( const std::string &name )
+{
+    for( auto &a : congestionAlgorithms )
+    {
+        if( name == a.name )
+            return a.provider;
+    }
+
+    return NULL;
+}
+
+// comma-separated algorithm names
+bool parseCongestionList( const char *spec, std::vector<std::string> &algos )
+{
+    algos.clear();
+
+    std::stringstream ss( spec );
+    std::string name;
+
+    while( std::getline( ss, name, ',' ) )
+    {
+        if( !isCongestionAlgorithm( name ) ||
+            (name.size() >= sizeof(ClientSpecificTestParameters().congestion)) )
+            return false;
+
+        algos.push_back( name );
+    }
+
+    return !algos.empty();
+}
+
+bool runPowerShell( const char *script )
+{
+    std::string cmd = std::string( "powershell -NoProfile -NonInteractive -Command \"" ) +
+        "$ErrorActionPreference='Stop'; " + script + "\" >NUL";
+
+    return system( cmd.c_str() ) == 0;
+}
+
+// the first line a script prints
+bool readPowerShell( const char *script, std::string &line )
+{
+    std::string cmd = std::string( "powershell -NoProfile -NonInteractive -Command \"" ) +
+        "$ErrorActionPreference='Stop'; " + script + "\"";
+
+    FILE *p = _popen( cmd.c_str(), "r" );
+    if( p == NULL )
+        return false;
+
+    char buf[256] = "";
+    bool read = fgets( buf, sizeof(buf), p ) != NULL;
+
+    if( (_pclose( p ) != 0) || !read )
+        return false;
+
+    line = buf;
+    line.erase( line.find_last_not_of( " \r\n" ) + 1 );
+    return !line.empty();
+}
+
+// one incast process per host may change the template; false if
+// another one already has it
+bool ownCongestionTemplate()
+{
+    if( ccState.owner != NULL )
+        return true;
+
+    // across sessions where we may, else within ours
+    HANDLE h = CreateMutexA( NULL, FALSE, "Global\\IncastCongestionTemplate" );
+    if( h == NULL )
+        h = CreateMutexA( NULL, FALSE, "Local\\IncastCongestionTemplate" );
+
+    if( (h == NULL) || (GetLastError() == ERROR_ALREADY_EXISTS) )
+    {
+        if( h != NULL )
+            CloseHandle( h );
+        return false;
+    }
+
+    // held until we exit
+    ccState.owner = h;
+    return true;
+}
+
+// remove our transport filter for these ports, if there is one, and
+// put the template's provider back
+void clearCongestionFilter()
+{
+    if( !ccState.original.empty() )
+    {
+        char script[256];
+        sprintf_s( script, sizeof(script),
+            "Set-NetTCPSetting -SettingName %s -CongestionProvider %s",
+            CONGESTION_TEMPLATE, ccState.original.c_str() );
+
+        if( !runPowerShell( script ) )
+        {
+            fprintf(stderr, "could not restore congestion provider %s of %s\n",
+                ccState.original.c_str(), CONGESTION_TEMPLATE);
+        }
+
+        ccState.original.clear();
+    }
+
+    if( !ccState.filtered )
+        return;
+
+    char script[512];
+    sprintf_s( script, sizeof(script),
+        "Get-NetTransportFilter -SettingName %s | "
+        "Where-Object { $_.%sPortStart -eq %u -and $_.%sPortEnd -eq %u } | "
+        "Remove-NetTransportFilter -Confirm:$false",
+        CONGESTION_TEMPLATE,
+        ccState.local ? "Local" : "Remote", ccState.first,
+        ccState.local ? "Local" : "Remote", ccState.last );
+
+    runPowerShell( script );
+    ccState.filtered = false;
+}
+
+BOOL WINAPI congestionCtrlHandler( DWORD )
+{
+    clearCongestionFilter();
+    return FALSE;
+}
+
+// local: ports are our listen ports, otherwise the server's
+bool setCongestionAlgorithm( const std::string &name, bool local, unsigned first, unsigned last )
+{
+    clearCongestionFilter();
+
+    const char *provider = congestionProvider( name );
+    if( provider == NULL )
+        return true;
+
+    char script[1024];
+    sprintf_s( script, sizeof(script),
+        "(Get-NetTCPSetting -SettingName %s).CongestionProvider", CONGESTION_TEMPLATE );
+
+    if( !readPowerShell( script, ccState.original ) )
+    {
+        fprintf(stderr, "could not read the congestion provider of %s, run as administrator?\n",
+            CONGESTION_TEMPLATE);
+        ccState.original.clear();
+        return false;
+    }
+
+    // from here on the template needs putting back, however we exit
+    static bool handlerInstalled = false;
+    if( !handlerInstalled )
+    {
+        SetConsoleCtrlHandler( congestionCtrlHandler, TRUE );
+        atexit( clearCongestionFilter );
+        handlerInstalled = true;
+    }
+
+    sprintf_s( script, sizeof(script),
+        "Set-NetTCPSetting -SettingName %s -CongestionProvider %s; "
+        "New-NetTransportFilter -SettingName %s "
+        "-LocalPortStart %u -LocalPortEnd %u -RemotePortStart %u -RemotePortEnd %u | Out-Null",
+        CONGESTION_TEMPLATE, provider, CONGESTION_TEMPLATE,
+        local ? first : 0, local ? last : 65535,
+        local ? 0 : first, local ? 65535 : last );
+
+    if( !runPowerShell( script ) )
+    {
+        fprintf(stderr, "could not set congestion provider %s, run as administrator?\n", provider);
+        return false;
+    }
+
+    ccState.filtered = true;
+    ccState.local = local;
+    ccState.first = first;
+    ccState.last = last;
+    return true;
+}
+
+// server side, for a uniform choice; with a mix the fan-outs stay on
+// the system default
+void serverSetCongestion()
+{
+    if( ccState.mix.size() == 1 )
+    {
+        if( !ownCongestionTemplate() )
+        {
+            fprintf(stderr, "another incast process on this host is using %s; "
+                "-cc and -cmp need one per host\n", CONGESTION_TEMPLATE);
+            exit(-1);
+        }
+
+        setCongestionAlgorithm( ccState.mix[0], true, basePort, basePort + listenPorts - 1 );
+    }
+}
+
+const char *congestionFor( int client_num )
+{
+    return ccState.mix.empty() ? "default" : ccState.mix[client_num % ccState.mix.size()].c_str();
+}
+
+// serverThread, after sending the parameters; returns false if the run
+// has to start over once the clients have reconnected
+bool serverCongestionHandshake( SOCKET s, TestResult &tr )
+{
+    int bytes;
+
+    if ((bytes = recv(s, &tr.congestion_status, 1, MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() congestion status failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == 1);
+
+    if( tr.congestion_status == CONGESTION_CHANGED )
+    {
+        InterlockedExchange( &ccState.reconnect, 1 );
+    }
+
+    if( tr.congestion_status == CONGESTION_SHARED )
+    {
+        fprintf(stderr, "a client shares its host's %s with another incast process; "
+            "-cc and -cmp need one per host\n", CONGESTION_TEMPLATE);
+        exit(-1);
+    }
+
+    // now every client has answered
+    pab->wait();
+
+    const bool again = (ccState.reconnect != 0);
+
+    if( tr.congestion_status != CONGESTION_CHANGED )
+    {
+        char decision = again ? CONGESTION_AGAIN : CONGESTION_GO;
+        if ((bytes = send(s, &decision, 1, 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "send() congestion decision failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == 1);
+    }
+
+    return !again;
+}
+
+// clientMain; returns false if the client has to reconnect first
+bool clientCongestionHandshake( SOCKET s, const ClientSpecificTestParameters &cstp, unsigned port )
+{
+    static std::string applied( "default" );
+
+    char status = CONGESTION_READY;
+
+    if( cstp.congestion_set && !ownCongestionTemplate() )
+    {
+        fprintf(stderr, "another incast process on this host is using %s\n", CONGESTION_TEMPLATE);
+        status = CONGESTION_SHARED;
+    }
+    else if( applied != cstp.congestion )
+    {
+        if( setCongestionAlgorithm( cstp.congestion, false, port, port ) )
+        {
+            applied = cstp.congestion;
+            status = CONGESTION_CHANGED;
+        }
+        else
+        {
+            status = CONGESTION_FAILED;
+        }
+    }
+
+    int bytes;
+    if ((bytes = send(s, &status, 1, 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() congestion status failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == 1);
+
+    if( status == CONGESTION_CHANGED )
+    {
+        printf( "congestion control now %s, reconnecting\n", cstp.congestion );
+        return false;
+    }
+
+    char decision;
+    if ((bytes = recv(s, &decision, 1, MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() congestion decision failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == 1);
+
+    return decision == CONGESTION_GO;
+}
+
+std::string congestionDescription()
+{
+    if( ccState.mix.empty() )
+        return "system default";
+
+    std::string s;
+    for( auto &a : ccState.mix )
+    {
+        s += s.empty() ? a : "," + a;
+    }
+
+    if( ccState.mix.size() > 1 )
+        s += " (round robin)";
+
+    return s;
+}
+
+void reportCongestion()
+{
+    if( ccState.mix.empty() )
+        return;
+
+    bool header = false;
+
+    for( unsigned c = 0; c < clientResults.size(); ++c )
+    {
+        if( clientResults[c].congestion_status == CONGESTION_FAILED )
+        {
+            if( !header )
+            {
+                printf( "\nCongestion control not applied:\n" );
+                header = true;
+            }
+
+            printf( "\tclient %3d from %15s: %s\n",
+                c, addressString( clientAddresses[c] ).c_str(), congestionFor( c ) );
+        }
+    }
+}
+
+void reportCongestionComparison( const std::vector<TestSummary> &runs )
+{
+    printf( "\nCongestion control comparison:\n" );
+    printf( "\t%-10s %12s %12s %12s %12s %12s %12s\n",
+        "algorithm", "median usec", "99th usec", "max usec", "mbit/s recv", "iter/sec", "retransmits" );
+
+    for( unsigned r = 0; r < runs.size(); ++r )
+    {
+        const TestSummary &t = runs[r];
+        printf( "\t%-10s %12.3f %12.3f %12.3f %12.3f %12.3f %12d\n",
+            ccState.compare[r].c_str(),
+            t.median_usec, t.p99_usec, t.max_usec, t.recv_mbps, t.iters_per_sec, t.retransmits );
+    }
+}
+
+#endif // _INCAST_CONGESTION_H
@@ -0,0 +1,308 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_COUNTERS_H
+#define _INCAST_COUNTERS_H
+
+#include <winternl.h>
+
+// Host counters around the measured phase, to tell a slow host from a
+// slow network.
+//
+// Windows has no perf_event.  Instruction and cache miss counts need a
+// kernel trace session with PMU sources, an elevated prompt and a PMU
+// the hypervisor passes through, so we keep to what any process can read
+// cheaply, on the server and every client:
+//
+//     cycles              QueryThreadCycleTime, per volley thread
+//     context switches    per volley thread, from the thread list of
+//                         SystemProcessInformation
+//     migrations          processor changes seen between volleys; a
+//                         lower bound
+//     DPC and interrupt   SystemProcessorPerformanceInformation, per
+//     time                processor group and summed over the host; the
+//                         nearest thing to softirq time
+//
+// The system information comes from ntdll.  If it can't be read, the
+// report keeps cycles and migrations and leaves the rest to the process
+// CPU times of reportCpu.
+
+struct CounterSnapshot
+{
+    bool system;                        // the system information was read
+    __int64 dpc_usec;
+    __int64 interrupt_usec;
+    std::map<DWORD, ULONG> switches;    // by thread id, this process
+
+    CounterSnapshot()
+        : system(false)
+        , dpc_usec(0)
+        , interrupt_usec(0)
+    {};
+};
+
+// winternl.h leaves it out; without it the plain query only covers the
+// caller's processor group
+extern "C" NTSTATUS NTAPI NtQuerySystemInformationEx( SYSTEM_INFORMATION_CLASS infoClass,
+    PVOID input, ULONG inputLength, PVOID info, ULONG infoLength, PULONG returnLength );
+
+CounterSnapshot countersBefore;
+
+int currentProcessor()
+{
+    PROCESSOR_NUMBER pn;
+    GetCurrentProcessorNumberEx( &pn );
+    return pn.Group * 64 + pn.Number;
+}
+
+// DPC and interrupt time over every processor, a group at a time
+bool readProcessorTimes( CounterSnapshot &snap )
+{
+    snap.dpc_usec = 0;
+    snap.interrupt_usec = 0;
+
+    const WORD groups = GetActiveProcessorGroupCount();
+
+    for( USHORT g = 0; g < groups; ++g )
+    {
+        std::vector<SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION> perf( GetActiveProcessorCount( g ) );
+        ULONG size = (ULONG) (perf.size() * sizeof(perf[0]));
+
+        if( NtQuerySystemInformationEx( SystemProcessorPerformanceInformation, &g, sizeof(g),
+            perf.data(), size, &size ) < 0 )
+            return false;
+
+        for( unsigned p = 0; p < size / sizeof(perf[0]); ++p )
+        {
+            // Reserved1 is DpcTime then InterruptTime, in 100 nsec units
+            snap.dpc_usec += perf[p].Reserved1[0].QuadPart / 10;
+            snap.interrupt_usec += perf[p].Reserved1[1].QuadPart / 10;
+        }
+    }
+
+    return true;
+}
+
+// the context switches of each of our threads so far
+bool readContextSwitches( CounterSnapshot &snap )
+{
+    std::vector<char> buf( 256 * 1024 );
+    ULONG needed = 0;
+    NTSTATUS status;
+
+    while( (status = NtQuerySystemInformation( SystemProcessInformation,
+        buf.data(), (ULONG) buf.size(), &needed )) < 0 )
+    {
+        if( buf.size() >= 64 * 1024 * 1024 )
+            return false;
+
+        buf.resize( std::max<size_t>( buf.size() * 2, needed ) );
+    }
+
+    const HANDLE self = (HANDLE) (ULONG_PTR) GetCurrentProcessId();
+
+    for( char *p = buf.data(); ; )
+    {
+        SYSTEM_PROCESS_INFORMATION *proc = (SYSTEM_PROCESS_INFORMATION *) p;
+
+        if( proc->UniqueProcessId == self )
+        {
+            // the threads follow their process; Reserved3 is the
+            // context switch count
+            SYSTEM_THREAD_INFORMATION *t = (SYSTEM_THREAD_INFORMATION *) (proc + 1);
+
+            snap.switches.clear();
+            for( ULONG k = 0; k < proc->NumberOfThreads; ++k )
+            {
+                snap.switches[(DWORD) (ULONG_PTR) t[k].ClientId.UniqueThread] = t[k].Reserved3;
+            }
+
+            return true;
+        }
+
+        if( proc->NextEntryOffset == 0 )
+            return false;
+
+        p += proc->NextEntryOffset;
+    }
+}
+
+void takeCounterSnapshot( CounterSnapshot &snap )
+{
+    snap.system = readProcessorTimes( snap ) && readContextSwitches( snap );
+}
+
+// a volley thread, before its measured loop
+void countersThreadStart( HostCounters &hc )
+{
+    hc = HostCounters();
+    hc.thread_id = GetCurrentThreadId();
+    hc.cpu = currentProcessor();
+    QueryThreadCycleTime( GetCurrentThread(), &hc.cycles );
+}
+
+// after every volley, outside the measurement
+void countersVolley( HostCounters &hc )
+{
+    const int cpu = currentProcessor();
+    if( cpu != hc.cpu )
+    {
+        hc.migrations++;
+        hc.cpu = cpu;
+    }
+}
+
+void countersThreadStop( HostCounters &hc )
+{
+    ULONG64 now;
+    QueryThreadCycleTime( GetCurrentThread(), &now );
+    hc.cycles = now - hc.cycles;
+}
+
+// hc's context switches and its host's times, from countersBefore to after
+void countersSystem( const CounterSnapshot &after, HostCounters &hc )
+{
+    if( !countersBefore.system || !after.system )
+        return;
+
+    auto b = countersBefore.switches.find( hc.thread_id );
+    auto a = after.switches.find( hc.thread_id );
+    if( (b == countersBefore.switches.end()) || (a == after.switches.end()) )
+        return;
+
+    hc.system = true;
+    hc.context_switches = a->second - b->second;
+    hc.dpc_usec = after.dpc_usec - countersBefore.dpc_usec;
+    hc.interrupt_usec = after.interrupt_usec - countersBefore.interrupt_usec;
+}
+
+// serverThread, released once every volley thread is done
+void serverCountersStop()
+{
+    CounterSnapshot after;
+    takeCounterSnapshot( after );
+
+    for( int c = 0; c < incastClients(); ++c )
+    {
+        countersSystem( after, clientResults[c].counters );
+    }
+}
+
+// clientMain, after its measured loop
+void clientCountersStop( HostCounters &hc )
+{
+    countersThreadStop( hc );
+
+    CounterSnapshot after;
+    takeCounterSnapshot( after );
+    countersSystem( after, hc );
+}
+
+void reportCounters()
+{
+    if( !gtp.host_counters )
+        return;
+
+    const int clients = clientResults.size();
+    const double volleys = gtp.iters;
+    const double fanInBytes = volleys * gtp.fi_msg_size;
+
+    HostCounters server, client;
+    int serverSystem = 0, clientSystem = 0;
+
+    // clients on the same host share its DPC and interrupt time, so
+    // take each host's once
+    std::map<std::string, std::pair<__int64, __int64>> hosts;
+
+    for( int c = 0; c < clients; ++c )
+    {
+        const HostCounters &s = clientResults[c].counters;
+        server.cycles += s.cycles;
+        server.migrations += s.migrations;
+        if( s.system )
+        {
+            server.context_switches += s.context_switches;
+            server.dpc_usec = s.dpc_usec;
+            server.interrupt_usec = s.interrupt_usec;
+            serverSystem++;
+        }
+
+        const HostCounters &k = clientResults[c].crd.counters;
+        client.cycles += k.cycles;
+        client.migrations += k.migrations;
+        if( k.system )
+        {
+            client.context_switches += k.context_switches;
+            auto &h = hosts[clientResults[c].crd.host];
+            h.first = std::max( h.first, k.dpc_usec );
+            h.second = std::max( h.second, k.interrupt_usec );
+            clientSystem++;
+        }
+    }
+
+    for( auto &h : hosts )
+    {
+        client.dpc_usec += h.second.first;
+        client.interrupt_usec += h.second.second;
+    }
+
+    // the server's threads together; a client's thread on its own
+    printf( "\nHost counters (measured phase):\n" );
+    printf( "\t                      %10s %10s\n", "server", "client avg" );
+    printf( "\tcycles/volley:        %10.0f %10.0f\n",
+        server.cycles / volleys, client.cycles / volleys / clients );
+    printf( "\tcycles/fan-in byte:   %10.3f %10.3f\n",
+        server.cycles / fanInBytes / clients, client.cycles / fanInBytes / clients );
+    printf( "\tmigrations/volley:    %10.3f %10.3f\n",
+        server.migrations / volleys, client.migrations / volleys / clients );
+
+    if( serverSystem )
+    {
+        printf( "\tctx switches/volley:  %10.3f", server.context_switches / volleys );
+    }
+    else
+    {
+        printf( "\tctx switches/volley:  %10s", "n/a" );
+    }
+
+    if( clientSystem )
+        printf( " %10.3f\n", client.context_switches / volleys / clientSystem );
+    else
+        printf( " %10s\n", "n/a" );
+
+    // whole hosts, all clients' hosts together
+    printf( "\thost DPC usec/volley: %10.3f %10.3f\n",
+        server.dpc_usec / volleys, client.dpc_usec / volleys );
+    printf( "\thost intr usec/volley:%10.3f %10.3f\n",
+        server.interrupt_usec / volleys, client.interrupt_usec / volleys );
+
+    if( !serverSystem || (clientSystem < clients) )
+    {
+        printf( "\tsystem counters unavailable on some hosts, see CPU above\n" );
+    }
+}
+
+#endif // _INCAST_COUNTERS_H
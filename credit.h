@@ -0,0 +1,301 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_CREDIT_H
+#define _INCAST_CREDIT_H
+
+// Credit-based fan-in.  With -credit W clients no longer send the whole
+// fan-in at once.  They split it into gtp.credit_chunk sized chunks and
+// send one chunk per credit byte the server gives them, and the server
+// hands out credits so that at most W bytes are granted but not yet
+// received across all clients.  A freed credit goes to the next client
+// in round robin order, or with -csrf to the one with the fewest chunks
+// still to grant.
+//
+// A serverThread sends its client's grants as soon as they are handed
+// out, even while a chunk is on its way in: the fan-in is read with an
+// overlapped receive, and the thread waits on that and on its wake event
+// together, so no freed credit sits idle behind a blocked recv.
+//
+// The test runs twice, plain and then with credits, so the two can be
+// compared at the same sizes.  Grants are single bytes going against
+// the fan-in, which Nagle would hold back, so it is off in both runs.
+// Warm-up sends whole fan-ins.
+
+struct CreditArbiter
+{
+    CRITICAL_SECTION lock;
+    int free;                       // credits not granted to anyone
+    std::vector<int> wanting;       // per client, chunks not yet granted
+    std::vector<int> granted;       // per client, grants not yet sent
+    std::vector<HANDLE> wake;       // per client, auto-reset
+    std::vector<WSAEVENT> arrived;  // per client, its fan-in receive completed
+    int next;                       // round robin position
+    volatile LONG64 grants;
+
+    CreditArbiter()
+    {
+        InitializeCriticalSection( &lock );
+    }
+} credits;
+
+int creditChunks( int size )
+{
+    return (size + gtp.credit_chunk - 1) / gtp.credit_chunk;
+}
+
+// runTest, before the serverThreads start
+void creditStart()
+{
+    const int clients = incastClients();
+
+    credits.free = std::max( 1, gtp.credit_window / gtp.credit_chunk );
+    credits.wanting.assign( clients, 0 );
+    credits.granted.assign( clients, 0 );
+    credits.next = 0;
+    credits.grants = 0;
+
+    for( int c = 0; c < clients; ++c )
+    {
+        credits.wake.push_back( CreateEvent( NULL, FALSE, FALSE, NULL ) );
+        credits.arrived.push_back( WSACreateEvent() );
+    }
+}
+
+void creditStop()
+{
+    for( auto h : credits.wake )
+        CloseHandle( h );
+    for( auto h : credits.arrived )
+        WSACloseEvent( h );
+
+    credits.wake.clear();
+    credits.arrived.clear();
+}
+
+// with the lock held: hand out whatever credits are free
+void creditDispatch()
+{
+    const int clients = (int) credits.wanting.size();
+
+    while( credits.free > 0 )
+    {
+        int pick = -1;
+
+        for( int k = 0; k < clients; ++k )
+        {
+            int c = (credits.next + k) % clients;
+            if( credits.wanting[c] == 0 )
+                continue;
+
+            if( !gtp.credit_srf )
+            {
+                pick = c;
+                break;
+            }
+
+            if( (pick < 0) || (credits.wanting[c] < credits.wanting[pick]) )
+                pick = c;
+        }
+
+        if( pick < 0 )
+            return;
+
+        credits.wanting[pick]--;
+        credits.granted[pick]++;
+        credits.free--;
+        credits.next = (pick + 1) % clients;
+
+        SetEvent( credits.wake[pick] );
+    }
+}
+
+// send whatever has been granted to this client since last time
+void creditSendGrants( SOCKET s, int client_num, int &outstanding )
+{
+    EnterCriticalSection( &credits.lock );
+    int grant = credits.granted[client_num];
+    credits.granted[client_num] = 0;
+    LeaveCriticalSection( &credits.lock );
+
+    if( grant == 0 )
+        return;
+
+    char grants[256];
+    memset( grants, 'G', sizeof(grants) );
+    int bytes;
+
+    for( int sent = 0; sent < grant; )
+    {
+        int n = std::min( grant - sent, (int) sizeof(grants) );
+        if ((bytes = send(s, grants, n, 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "send() credits failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == n);
+        sent += n;
+    }
+
+    InterlockedExchangeAdd64( &credits.grants, grant );
+    outstanding += grant;
+}
+
+// serverThread, in place of receiving the fan-in in one piece
+void creditFanIn( SOCKET s, int client_num, char *buf, int size )
+{
+    const int chunks = creditChunks( size );
+
+    EnterCriticalSection( &credits.lock );
+    credits.wanting[client_num] = chunks;
+    creditDispatch();
+    LeaveCriticalSection( &credits.lock );
+
+    int received = 0;       // bytes
+    int completed = 0;      // chunks
+    int outstanding = 0;    // chunks granted but not yet in
+
+    WSAOVERLAPPED ov;
+    bool posted = false;
+
+    while( completed < chunks )
+    {
+        creditSendGrants( s, client_num, outstanding );
+
+        // a receive for as much as the grants sent so far will bring
+        if( !posted && (outstanding > 0) )
+        {
+            const int limit = std::min( size, (completed + outstanding) * gtp.credit_chunk );
+
+            memset( &ov, 0, sizeof(ov) );
+            ov.hEvent = credits.arrived[client_num];
+            WSAResetEvent( ov.hEvent );
+
+            WSABUF wb = { (ULONG) (limit - received), buf + received };
+            DWORD n, flags = 0;
+            if ((WSARecv(s, &wb, 1, &n, &flags, &ov, NULL) == SOCKET_ERROR) &&
+                (WSAGetLastError() != WSA_IO_PENDING))
+            {
+                fprintf(stderr, "WSARecv() fan-in chunk failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+
+            posted = true;
+        }
+
+        // new grants to send, or data in
+        HANDLE waits[2] = { credits.wake[client_num], credits.arrived[client_num] };
+        if( WaitForMultipleObjects( posted ? 2 : 1, waits, FALSE, INFINITE ) == WAIT_OBJECT_0 )
+            continue;
+
+        DWORD n, flags;
+        if (!WSAGetOverlappedResult(s, &ov, &n, FALSE, &flags) || (n == 0))
+        {
+            fprintf(stderr, "WSARecv() fan-in chunk failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        posted = false;
+        received += n;
+
+        // free the credits of every chunk now complete
+        const int now = (received == size) ? chunks : received / gtp.credit_chunk;
+        if( now > completed )
+        {
+            outstanding -= now - completed;
+
+            EnterCriticalSection( &credits.lock );
+            credits.free += now - completed;
+            creditDispatch();
+            LeaveCriticalSection( &credits.lock );
+
+            completed = now;
+        }
+    }
+}
+
+// clientMain, in place of sending the fan-in in one piece
+void clientCreditFanIn( SOCKET s, const char *buf, int size )
+{
+    const int chunks = creditChunks( size );
+    int bytes;
+
+    for( int sent = 0; sent < chunks; )
+    {
+        char grants[256];
+        if ((bytes = recv(s, grants, std::min( (int) sizeof(grants), chunks - sent ), 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() credits failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes > 0);
+
+        for( int g = 0; g < bytes; ++g, ++sent )
+        {
+            const int offset = sent * gtp.credit_chunk;
+            const int len = std::min( gtp.credit_chunk, size - offset );
+
+            int n;
+            if ((n = send(s, buf + offset, len, 0)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "send() fan-in chunk failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(n == len);
+        }
+    }
+}
+
+void reportCredit()
+{
+    if( !gtp.credit_on )
+        return;
+
+    printf( "\nCredit-based fan-in:\n" );
+    printf( "\twindow bytes:         %10d\n", gtp.credit_window );
+    printf( "\tchunk bytes:          %10d\n", gtp.credit_chunk );
+    printf( "\tcredits:              %10d\n", std::max( 1, gtp.credit_window / gtp.credit_chunk ) );
+    printf( "\torder:                %10s\n", gtp.credit_srf ? "srf" : "rr" );
+    printf( "\tgrants per volley:    %10.3f\n", ((double) credits.grants) / gtp.iters );
+}
+
+void reportCreditComparison( const std::vector<TestSummary> &runs )
+{
+    const char *mode[] = { "plain", "credit" };
+
+    printf( "\nCredit-based fan-in comparison:\n" );
+    printf( "\t%-10s %12s %12s %12s %12s %12s %12s\n",
+        "fan-in", "median usec", "99th usec", "max usec", "mbit/s recv", "iter/sec", "retransmits" );
+
+    for( unsigned r = 0; r < runs.size(); ++r )
+    {
+        const TestSummary &t = runs[r];
+        printf( "\t%-10s %12.3f %12.3f %12.3f %12.3f %12.3f %12d\n",
+            mode[r], t.median_usec, t.p99_usec, t.max_usec, t.recv_mbps, t.iters_per_sec, t.retransmits );
+    }
+}
+
+#endif // _INCAST_CREDIT_H
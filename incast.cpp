@@ -28,15 +28,52 @@
 #include "utils.h"
 #include "tcpstats.h"
 #include "histogram.h"
+#include "shuffle.h"
+#include "congestion.h"
+#include "report.h"
+#include "placement.h"
+#include "payload.h"
+#include "warmup.h"
+#include "confidence.h"
+#include "sim.h"
+#include "relay.h"
+#include "launcher.h"
+#include "background.h"
+#include "service.h"
+#include "reduce.h"
+#include "interfaces.h"
+#include "churn.h"
+#include "credit.h"
+#include "stagger.h"
+#include "collapse.h"
+#include "trace.h"
+#include "stripe.h"
+#include "counters.h"
+#include "release.h"
 
 using namespace std;
 
+void recvClientResults( SOCKET s, TestResult &tr )
+{
+    int bytes;
+    if ((bytes = recv(s, (char*) &tr.crd, sizeof(ClientResultData), MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() client results failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == sizeof(ClientResultData));
+}
+
 unsigned int __stdcall serverThread( void *p )
 {
     int client_num = (int) p;
     SOCKET s = clientSockets[client_num];
     int bytes;
 
+    TestResult &tr = clientResults[client_num];
+    Placement &placed = tr.placement;
+    applyPlacement( gtp.placement, client_num, s, placed );
+
     if( (gtp.delay > 0) && (gtp.delay_method == RANDOM_JITTER) )
     {
         // each thread needs a unique seed
@@ -55,6 +92,8 @@ unsigned int __stdcall serverThread( void *p )
     // send client-specific test parameters to client
     ClientSpecificTestParameters cstp;
     cstp.client_num = client_num;
+    strcpy_s( cstp.congestion, sizeof(cstp.congestion), congestionFor( client_num ) );
+    cstp.congestion_set = !ccState.mix.empty();
 
     if ((bytes = send(s, (char*) &cstp, sizeof(ClientSpecificTestParameters), 0)) == SOCKET_ERROR)
     {
@@ -62,9 +101,39 @@ unsigned int __stdcall serverThread( void *p )
         exit(-1);
     }
     HARD_ASSERT(bytes == sizeof(ClientSpecificTestParameters));
+
+    if( !serverCongestionHandshake( s, tr ) )
+    {
+        // serverMain starts over once the clients have reconnected
+        return 0;
+    }
+
+    if( gtp.shuffle )
+    {
+        shuffleExchangePeers( s, client_num );
+    }
+
+    if( isBackgroundClient( client_num ) )
+    {
+        serverStream( s, client_num );
+        recvClientResults( s, tr );
+        return 0;
+    }
+
+    if( gtp.stripes > 1 )
+    {
+        stripeWaitConnected( s, client_num, tr );
+    }
     
-    unique_ptr<char[]> fobuf( new char[gtp.fo_msg_size] );
-    unique_ptr<char[]> fibuf( new char[gtp.fi_msg_size] );
+    // in shuffle mode the client only tells us when its round is done
+    const int fi_size = gtp.shuffle ? SHUFFLE_DONE_MSG_SIZE : gtp.fi_msg_size;
+
+    LocalBuffer fobuf( allocLocalBuffer( gtp.fo_msg_size, placed ) );
+    LocalBuffer fibuf( allocLocalBuffer( fi_size, placed ) );
+
+    // a reduce pool works on one buffer while we receive into the other
+    const bool pooled = (gtp.reduce_op != REDUCE_NONE) && (gtp.reduce_threads > 0);
+    LocalBuffer fibuf2( allocLocalBuffer( pooled ? fi_size : 1, placed ) );
 
     if( client_num == 0 )
     {
@@ -72,13 +141,40 @@ unsigned int __stdcall serverThread( void *p )
     }
     
     // warm-up
-    for( int i = 0; i < WARMUP_ITERS; ++i )
+    const bool adaptive = (gtp.warmup_cap > 0);
+
+    for( int i = 0; adaptive || (i < WARMUP_ITERS); ++i )
     {
+        if( gtp.verify )
+        {
+            fillPayload( fobuf.get(), gtp.fo_msg_size, client_num, -1 - i );
+        }
+
         // synchronize with the other serverThreads
-        pb->wait();
+        if( !adaptive )
+        {
+            pb->wait();
+        }
+        else
+        {
+            pb->wait( warmupCheck );
+
+            if( warmup.done )
+            {
+                if ((bytes = send(s, &WARMUP_DONE, 1, 0)) == SOCKET_ERROR)
+                {
+                    fprintf(stderr, "send() warm-up done failed: %d\n", WSAGetLastError());
+                    exit(-1);
+                }
+                HARD_ASSERT(bytes == 1);
+                break;
+            }
+        }
+
+        __int64 start = qpc();
         
-        // send the fan-out
-        if ((bytes = send(s, fobuf.get(), gtp.fo_msg_size, 0)) == SOCKET_ERROR)
+        // send the fan-out, behind the phase byte if adaptive
+        if ((bytes = sendMessage(s, adaptive ? &WARMUP_VOLLEY : NULL, fobuf.get(), gtp.fo_msg_size)) == SOCKET_ERROR)
         {
             fprintf(stderr, "send() fan-out failed: %d\n", WSAGetLastError());
             exit(-1);
@@ -86,30 +182,105 @@ unsigned int __stdcall serverThread( void *p )
         HARD_ASSERT(bytes == gtp.fo_msg_size);
 
         // expect the fan-in
-        if ((bytes = recv(s, fibuf.get(), gtp.fi_msg_size, MSG_WAITALL)) == SOCKET_ERROR)
+        if( gtp.stripes > 1 )
         {
-            fprintf(stderr, "recv() fan-in failed: %d\n", WSAGetLastError());
-            exit(-1);
+            stripeRecvFanIn( client_num, fibuf.get(), fi_size, NULL );
+        }
+        else
+        {
+            if ((bytes = recvMessage(s, fibuf.get(), fi_size)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "recv() fan-in failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == fi_size);
+        }
+
+        if( adaptive )
+        {
+            warmup.start[client_num] = start;
+            warmup.stop[client_num] = qpc();
+        }
+
+        if( gtp.verify && !verifyPayload( fibuf.get(), fi_size, client_num, -1 - i ) )
+        {
+            tr.mismatches++;
         }
-        HARD_ASSERT(bytes == gtp.fi_msg_size);
     }
 
     if( client_num == 0 )
     {
         printf( "done!\nTesting..." );
-        GetTcpStatistics(&tcpStatsBefore);
+        getTcpStatistics(&tcpStatsBefore);
+        cpuBefore = getCpuTimes();
+
+        if( gtp.host_counters )
+        {
+            takeCounterSnapshot( countersBefore );
+        }
+    }
+
+    if( gtp.host_counters )
+    {
+        countersThreadStart( tr.counters );
     }
 
-    Measurement m;
+    Measurement m = {0};
+
+    if( gtp.stack_timing )
+    {
+        tr.stack_rtt_usec.reserve( gtp.iters );
+    }
     
     __int64 qpcStartTime = qpc();
 
     for( int i = 0; i < gtp.iters; ++i )
     {
-        // synchronize with the other serverThreads
-        pb->wait();
+        // fill and verify outside of the measurement
+        if( gtp.verify )
+        {
+            __int64 t = qpc();
+            fillPayload( fobuf.get(), gtp.fo_msg_size, client_num, i );
+            tr.verify_ticks += qpc() - t;
+        }
+
+        char *fi = (pooled && (i % 2)) ? fibuf2.get() : fibuf.get();
+
+        if( pooled )
+        {
+            reduceWaitBuffer( client_num, i );
+        }
+
+        // synchronize with the other serverThreads, tracing the volley
+        // before and checking for convergence every CONVERGE_INTERVAL
+        // volleys
+        const bool check = (gtp.converge_percentile > 0) && (i > 0) && (i % CONVERGE_INTERVAL == 0);
+
+        if( !check )
+        {
+            pb->wait( traceVolley );
+        }
+        else
+        {
+            pb->wait( []{ traceVolley(); convergenceCheck(); } );
+
+            if( convergence.converged )
+            {
+                if ((bytes = send(s, &CONVERGE_STOP, 1, 0)) == SOCKET_ERROR)
+                {
+                    fprintf(stderr, "send() convergence stop failed: %d\n", WSAGetLastError());
+                    exit(-1);
+                }
+                HARD_ASSERT(bytes == 1);
+                break;
+            }
+        }
         
         m.start = qpc();
+        m.release = pb->released_;
+        m.actual_delay = 0;
+
+        staggerAdmit( client_num, i, m.start );
 
         if( gtp.delay > 0 )
         {
@@ -121,7 +292,7 @@ unsigned int __stdcall serverThread( void *p )
             }
             else if( gtp.delay_method == UNIFORM_SCHED )
             {
-                target_delay = gtp.delay * ((double) client_num / gtp.clients);
+                target_delay = gtp.delay * ((double) client_num / incastClients());
             }
             else
             {
@@ -132,22 +303,72 @@ unsigned int __stdcall serverThread( void *p )
         }
 
         // send the fan-out
-        if ((bytes = send(s, fobuf.get(), gtp.fo_msg_size, 0)) == SOCKET_ERROR)
+        if ((bytes = sendMessage(s, check ? &CONVERGE_CONTINUE : NULL, fobuf.get(), gtp.fo_msg_size)) == SOCKET_ERROR)
         {
             fprintf(stderr, "send() fan-out failed: %d\n", WSAGetLastError());
             exit(-1);
         }
         HARD_ASSERT(bytes == gtp.fo_msg_size);
 
-        // expect the fan-in
-        if ((bytes = recv(s, fibuf.get(), gtp.fi_msg_size, MSG_WAITALL)) == SOCKET_ERROR)
+        // expect the fan-in, on a new connection if churning, a chunk
+        // per credit, or over the stripes
+        if( gtp.churn )
         {
-            fprintf(stderr, "recv() fan-in failed: %d\n", WSAGetLastError());
-            exit(-1);
+            fi = churnWait( client_num, i, tr, m.stop );
+        }
+        else if( gtp.credit_on )
+        {
+            creditFanIn( s, client_num, fi, fi_size );
+            m.stop = qpc();
+        }
+        else if( gtp.stripes > 1 )
+        {
+            stripeRecvFanIn( client_num, fi, fi_size, &tr );
+            m.stop = qpc();
+        }
+        else
+        {
+            if ((bytes = recvMessage(s, fi, fi_size)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "recv() fan-in failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == fi_size);
+        
+            m.stop = qpc();
+        }
+
+        staggerDone();
+
+        if( gtp.stack_timing )
+        {
+            TCP_INFO_v0 info;
+            if( getTcpInfo( s, info ) )
+            {
+                tr.stack_rtt_usec.push_back( info.RttUs );
+                tr.min_rtt_usec = info.MinRttUs;
+                tr.mss = info.Mss;
+            }
+        }
+
+        if( gtp.verify )
+        {
+            __int64 t = qpc();
+            if( !verifyPayload( fi, fi_size, client_num, i ) )
+            {
+                tr.mismatches++;
+            }
+            tr.verify_ticks += qpc() - t;
+        }
+
+        if( pooled )
+        {
+            reducePost( client_num, i, fi, fi_size );
+        }
+        else if( gtp.reduce_op != REDUCE_NONE )
+        {
+            reduceFanIn( client_num, i, fi, fi_size );
         }
-        HARD_ASSERT(bytes == gtp.fi_msg_size);
-    
-        m.stop = qpc();
 
         if( gtp.rate_limited )
         {
@@ -166,338 +387,228 @@ unsigned int __stdcall serverThread( void *p )
             }
         }
 
-        clientResults[client_num].measurements.push_back(m);
-    }
-    
-    // expect client results
-    ClientResultData * crd = &clientResults[client_num].crd;
-    if ((bytes = recv(s, (char*) crd, sizeof(ClientResultData), MSG_WAITALL)) == SOCKET_ERROR)
-    {
-        fprintf(stderr, "recv() client results failed: %d\n", WSAGetLastError());
-        exit(-1);
-    }
-    HARD_ASSERT(bytes == sizeof(ClientResultData));
+        tr.measurements.push_back(m);
 
-    return 0;
-}
-    
-void reportGlobalTestParameters()
-{
-    printf( "\n" );
-    printf( "Test parameters:\n" );
-    printf( "\tclients:              %d\n", gtp.clients );
-    printf( "\titerations:           %d\n", gtp.iters );
-    if( gtp.rate_limited )
-    {
-        printf( "\trate limit:           %d\n", gtp.target_rate );
-    }
-    else
-    {
-        printf( "\trate limit:           none\n" );
+        if( gtp.host_counters )
+        {
+            countersVolley( tr.counters );
+        }
     }
-    printf( "\tfan-out msg bytes:    %d\n", gtp.fo_msg_size );
-    printf( "\tfan-in msg bytes:     %d\n", gtp.fi_msg_size );
-   
-    printf( "\tNagle's algorithm:    %s\n", gtp.nagle ? "enabled" : "disabled" );
 
-    if( gtp.send_buffer >= 0 )
-    {
-        printf( "\tsend buffer size:     %d\n", gtp.send_buffer );
-    }
-    else
+    if( gtp.host_counters )
     {
-        printf( "\tsend buffer size:     OS default\n" );
+        countersThreadStop( tr.counters );
+        pb->wait( serverCountersStop );
     }
 
-    if( gtp.recv_buffer >= 0 )
+    if( pooled )
     {
-        printf( "\treceive buffer size:  %d\n", gtp.recv_buffer );
-    }
-    else
-    {
-        printf( "\treceive buffer size:  OS default\n" );
+        reduceDrain( client_num );
     }
+
+    backgroundVolleysDone();
     
-    if( gtp.delay > 0 )
-    {
-        printf( "\tdelay:                %d\n", gtp.delay );
-        printf( "\tdelay method:         %s\n", 
-            gtp.delay_method == RANDOM_JITTER ? "random jitter" : "uniform sched" );
-    }
-    else
+    // expect client results
+    recvClientResults( s, tr );
+
+    if( gtp.service_model != SERVICE_NONE )
     {
-        printf( "\tdelay:               none\n" );
+        recvServiceTimes( s, tr );
     }
-} 
-   
-void reportLatencyThroughput()
-{
-    try {
-
-    Histogram<__int64> hist;
-    __int64 globalFirstStart, globalLastStop;
 
-    int clients = clientResults.size();
+    return 0;
+}
+    
+unsigned int __stdcall acceptThread( void *p )
+{
+    SOCKET ls = acceptState.listenSockets[(int) p];
 
-    for( int i = 0; i < gtp.iters; ++i )
+    while( true )
     {
-        __int64 firstStart = numeric_limits<__int64>::max();
-        __int64 lastStop = numeric_limits<__int64>::min();
+        SOCKET cs;
+        SOCKADDR_INET sin = {0};
 
-        for( int c = 0; c < clients; ++c )
+        int nlen = sizeof(sin);
+        if ((cs = accept(ls, (SOCKADDR*) &sin, &nlen)) == INVALID_SOCKET)
         {
-            Measurements &m = clientResults[c].measurements;
-            firstStart = min( firstStart, m[i].start );
-            lastStop = max( lastStop, m[i].stop );
-        }
-    
-        HARD_ASSERT(lastStop>firstStart);
-        
-        hist.add(lastStop-firstStart);
-
-        if( i == 0 ) globalFirstStart = firstStart;
-        if( i == gtp.iters-1 ) globalLastStop = lastStop;
-    }
-   
-    // for delay, we also calculate the exclusive latency
-    // by subtracting the actual per-client, per-iteration
-    // delay, thus effectively pretending that all the
-    // tests began at exactly the same time
-    
-    Histogram<__int64> exclusive_hist;
+            // serverMain closes the listening sockets to stop us
+            if( acceptState.stopping )
+                break;
 
-#ifdef REPORT_DELAY
-    Histogram<__int64> delay_hist;
-#endif
+            fprintf(stderr, "accept() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
 
-    if( gtp.delay )
-    {
-        for( int i = 0; i < gtp.iters; ++i )
-        {
-            for( int c = 0; c < clients; ++c )
-            {
-                Measurements &m = clientResults[c].measurements;
-#ifdef REPORT_DELAY
-                delay_hist.add(m[i].actual_delay);
-#endif
-                m[i].stop -= m[i].actual_delay;
+        // set up the connection before serializing with the other
+        // accept threads
+        __int64 connectTime = qpc();
 
-            }
-            
-            __int64 firstStart = numeric_limits<__int64>::max();
-            __int64 lastStop = numeric_limits<__int64>::min();
+        nlen = sizeof(sin);
+        getpeername( cs, (struct sockaddr *)&sin, &nlen );
+        unmapAddress( sin );
 
-            for( int c = 0; c < clients; ++c )
-            {
-                Measurements &m = clientResults[c].measurements;
-                
-                firstStart = min( firstStart, m[i].start );
-                lastStop = max( lastStop, m[i].stop );
-            }
+        // the server interface the client came in on
+        SOCKADDR_INET local = {0};
+        nlen = sizeof(local);
+        getsockname( cs, (struct sockaddr *)&local, &nlen );
+        unmapAddress( local );
+        string iface( interfaceOf( local ) );
 
-            HARD_ASSERT(lastStop>firstStart);
+        applySocketOptions(cs);
 
-            exclusive_hist.add(lastStop-firstStart);
-        }
-    }
+        EnterCriticalSection( &acceptState.lock );
 
-    if( gtp.histogram )
-    {
-        histfile << freq << endl << endl;
-        if( gtp.delay )
+        if( acceptState.stopping || 
+            (gtp.clients_limited && (gtp.clients == gtp.client_limit)) )
         {
-#ifdef REPORT_DELAY
-            histfile << "Delay" << endl;
-            histfile << delay_hist.get_histogram_csv( 10000 ) << endl;
-#endif
-            histfile << "Exclusive" << endl;
-            histfile << exclusive_hist.get_histogram_csv( 10000 );
-            histfile << endl << "Inclusive" << endl;
+            LeaveCriticalSection( &acceptState.lock );
+            closesocket(cs);
+            continue;
         }
-        histfile << hist.get_histogram_csv( 10000 );
-        histfile.close();
-    }
-   
-    if( gtp.delay )
-        printf( "\nLatency (inclusive):\n" );
-    else
-        printf( "\nLatency:\n" );
 
-    double lmin = hist.get_min() * 1.0e6 / freq;
-    printf( "\tminimum usec/iter:    %10.3f\n", lmin );
-    
-    double lmax = hist.get_max() * 1.0e6 / freq;
-    printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
-    
-    double avg = hist.get_avg() * 1.0e6 / freq;
-    printf( "\taverage usec/iter:    %10.3f\n", avg );
-    
-    double median = hist.get_median() * 1.0e6 / freq;
-    printf( "\tmedian usec/iter:     %10.3f\n", median );
-    
-    double p95 = hist.get_percentile(0.95) * 1.0e6 / freq;
-    printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
-    
-    double p99 = hist.get_percentile(0.99) * 1.0e6 / freq;
-    printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
-    
-    if( gtp.delay )
-    {
-        printf( "\nLatency (exclusive):\n" );
+        const int client_num = gtp.clients++;
 
-        double lmin = exclusive_hist.get_min() * 1.0e6 / freq;
-        printf( "\tminimum usec/iter:    %10.3f\n", lmin );
+        string ip( addressString(sin) );
 
-        double lmax = exclusive_hist.get_max() * 1.0e6 / freq;
-        printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
+        clientAddresses.push_back(sin);
+        clientInterfaces.push_back(iface);
+        clientSockets.push_back(cs);
 
-        double avg = exclusive_hist.get_avg() * 1.0e6 / freq;
-        printf( "\taverage usec/iter:    %10.3f\n", avg );
+        if( client_num == 0 )
+            acceptState.firstConnect = connectTime;
+        acceptState.lastConnect = connectTime;
 
-        double median = exclusive_hist.get_median() * 1.0e6 / freq;
-        printf( "\tmedian usec/iter:     %10.3f\n", median );
+        if( bindAddresses.size() > 1 )
+            printf("\tClient %3d connected from %15s to %s\n", client_num, ip.c_str(), iface.c_str());
+        else
+            printf("\tClient %3d connected from %15s\n", client_num, ip.c_str());
 
-        double p95 = exclusive_hist.get_percentile(0.95) * 1.0e6 / freq;
-        printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
+        if( gtp.clients_limited && (gtp.clients == gtp.client_limit) )
+        {
+            SetEvent( acceptState.limitReached );
+        }
 
-        double p99 = exclusive_hist.get_percentile(0.99) * 1.0e6 / freq;
-        printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
-       
+        LeaveCriticalSection( &acceptState.lock );
     }
 
-#ifdef REPORT_DELAY
-    if( gtp.delay )
-    {
-        printf( "\nJitter:\n" );
-
-        double lmin = delay_hist.get_min() * 1.0e6 / freq;
-        printf( "\tminimum usec/iter:    %10.3f\n", lmin );
-
-        double lmax = delay_hist.get_max() * 1.0e6 / freq;
-        printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
+    return 0;
+}
 
-        double avg = delay_hist.get_avg() * 1.0e6 / freq;
-        printf( "\taverage usec/iter:    %10.3f\n", avg );
+void reportCpu()
+{
+    const int clients = clientResults.size();
 
-        double median = delay_hist.get_median() * 1.0e6 / freq;
-        printf( "\tmedian usec/iter:     %10.3f\n", median );
+    CpuTimes server = cpuAfter - cpuBefore;
 
-        double p95 = delay_hist.get_percentile(0.95) * 1.0e6 / freq;
-        printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
+    printf( "\nCPU (measured phase):\n" );
 
-        double p99 = delay_hist.get_percentile(0.99) * 1.0e6 / freq;
-        printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
-    }
-#endif
+    printf( "\tserver usec/iter:     %10.3f (user %.3f, kernel %.3f)\n",
+        ((double) server.user + server.kernel) / gtp.iters,
+        ((double) server.user) / gtp.iters,
+        ((double) server.kernel) / gtp.iters );
+    printf( "\tserver cores busy:    %10.3f\n",
+        ((double) server.user + server.kernel) / server.wall );
 
-    printf( "\nThroughput:\n" );
-    
-    double totalSeconds = ((double)(globalLastStop-globalFirstStart)) / freq;
-    double sendMBytes = gtp.fo_msg_size / 1.0e6 * clients * gtp.iters;
-    double recvMBytes = gtp.fi_msg_size / 1.0e6 * clients * gtp.iters;
-    double totalMBytes = sendMBytes + recvMBytes;
+    double clientUsec = 0;
+    double clientCores = 0;
 
-    double sendMbps = sendMBytes * 8 / totalSeconds;
-    printf( "\tmbit/sec send:        %10.3f\n", sendMbps );
-    
-    double recvMbps = recvMBytes * 8 / totalSeconds;
-    printf( "\tmbit/sec recv:        %10.3f\n", recvMbps );
-    
-    double totalMbps = totalMBytes * 8 / totalSeconds;
-    printf( "\tmbit/sec tot:         %10.3f\n", totalMbps );
-  
-    double ips = gtp.iters / totalSeconds;
-    printf( "\titer/sec:             %10.3f\n", ips );
-    
-    const double FUDGE_FACTOR = 0.95;
-    if( gtp.rate_limited && (ips < gtp.target_rate * FUDGE_FACTOR ) )
-    {
-        printf( "\nWarning: missed target of %d iterations/sec\n", gtp.target_rate );
-    }
-    
-    }
-    catch( exception& e )
+    for( int c = 0; c < clients; ++c )
     {
-        fprintf(stderr, "\nException caught: %s\n", e.what());
+        const CpuTimes &t = clientResults[c].crd.cpu;
+        clientUsec += t.user + t.kernel;
+        clientCores += ((double) t.user + t.kernel) / t.wall;
     }
+
+    printf( "\tclient usec/iter avg: %10.3f\n", clientUsec / clients / gtp.iters );
+    printf( "\tclient cores busy avg:%10.3f\n", clientCores / clients );
 }
 
-void serverMain()
+// Wait for clients.  The first run of an invocation waits for a key
+// press or the client limit; later runs wait for the same clients to
+// reconnect.
+void acceptClients( bool first )
 {
-    printf( "Server mode\n\n" );
-
-    SOCKET ls;
+    acceptState.stopping = false;
+    ResetEvent( acceptState.limitReached );
 
-    if ((ls = socket(PF_INET,SOCK_STREAM,0)) == INVALID_SOCKET)
+    // one listener per address and port, on every IPv4 address by default
+    for( int l = 0; l < listenPorts; ++l )
     {
-        fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
-        exit(-1);
-    }
+        if( bindAddresses.empty() )
+            acceptState.listenSockets.push_back( createListener( basePort + l ) );
 
-    SOCKADDR_IN sin = {0};
-    sin.sin_family = AF_INET;
-    sin.sin_port = htons(PORT);
-    sin.sin_addr.s_addr = INADDR_ANY;
-       
-    if (bind(ls, (SOCKADDR*) &sin, sizeof(SOCKADDR)) == SOCKET_ERROR)
-    {
-        fprintf(stderr, "bind() failed: %d\n", WSAGetLastError());
-        exit(-1);
+        for( auto &a : bindAddresses )
+            acceptState.listenSockets.push_back( createListener( basePort + l, 65535, &a ) );
     }
 
-    if (listen(ls, SOMAXCONN) == SOCKET_ERROR)
-    {
-        fprintf(stderr, "listen() failed: %d\n", WSAGetLastError());
-        exit(-1);
-    }
+    loadInterfaceTable();
 
-    printf( "Start clients and then press any key to begin test.\n" );
+    acceptState.listenStart = qpc();
 
-    while (!_kbhit())
+    // Windows has no SO_REUSEPORT; instead several threads block in
+    // accept() on each listener and the stack hands every pending
+    // connection to one of them
+    const int listeners = (int) acceptState.listenSockets.size();
+    for( int t = 0; t < listeners * acceptThreadsPerPort; ++t )
     {
-        if (isConnectionPending(ls))
-        {
-            SOCKET cs;
-
-            int nlen = sizeof(SOCKADDR);
-            if ((cs = accept(ls, (SOCKADDR*) &sin, &nlen)) == INVALID_SOCKET)
-            {
-                fprintf(stderr, "accept() failed: %d\n", WSAGetLastError());
-                exit(-1);
-            }
-
-            const int client_num = gtp.clients++;
-
-            nlen = sizeof(sockaddr);
-            getpeername( cs, (struct sockaddr *)&sin, &nlen );
-
-            string ip( inet_ntoa(sin.sin_addr) );
-
-            clientAddressMap[ip].push_back(client_num);
+        acceptState.threads.push_back(
+            (HANDLE) _beginthreadex( NULL, 0, acceptThread, (void*) (t % listeners), 0, NULL ) );
+    }
 
-            printf("\tClient %3d connected from %15.15s\n", client_num, ip.c_str());	
+    if( first )
+    {
+        if( listenPorts > 1 )
+            printf( "Listening on ports %u-%u", basePort, basePort + listenPorts - 1 );
+        else
+            printf( "Listening on port %u", basePort );
 
-            clientSockets.push_back(cs);
-    
-            if( gtp.nagle == false )
-                disableNagle(cs);
+        if( !bindAddresses.empty() )
+            printf( " of %s", bindDescription().c_str() );
+        printf( ".\n" );
 
-            if( gtp.send_buffer >= 0 )
-                setSocketBufferSize(cs, SO_SNDBUF, gtp.send_buffer );
-            
-            if( gtp.recv_buffer >= 0 )
-                setSocketBufferSize(cs, SO_RCVBUF, gtp.recv_buffer );
+        if( launcherParams.clients > 0 )
+            localLauncher.start();
+        else
+            printf( "Start clients and then press any key to begin test.\n" );
 
-            if( gtp.clients_limited && (gtp.clients == gtp.client_limit) )
+        while (!_kbhit())
+        {
+            if( WaitForSingleObject( acceptState.limitReached, 50 ) == WAIT_OBJECT_0 )
             {
                 printf( "Reached limit of %d clients.\n", gtp.client_limit );
                 break;
             }
         }
     }
+    else
+    {
+        printf( "\nWaiting for %d clients to reconnect.\n", gtp.client_limit );
+
+        if( WaitForSingleObject( acceptState.limitReached, RECONNECT_TIMEOUT_MSEC ) != WAIT_OBJECT_0 )
+        {
+            printf( "Only %d clients reconnected.\n", gtp.clients );
+        }
+    }
 
     // stop listening for clients
-    closesocket(ls);
+    EnterCriticalSection( &acceptState.lock );
+    acceptState.stopping = true;
+    LeaveCriticalSection( &acceptState.lock );
+
+    for( unsigned l = 0; l < acceptState.listenSockets.size(); ++l )
+    {
+        closesocket( acceptState.listenSockets[l] );
+    }
+
+    waitForThreads( acceptState.threads );
+
+    for( auto h : acceptState.threads )
+    {
+        CloseHandle( h );
+    }
+
+    acceptState.listenSockets.clear();
+    acceptState.threads.clear();
     
     if (gtp.clients <= 0)
     {
@@ -505,11 +616,44 @@ void serverMain()
         exit(0);
     }
     
+    if( incastClients() <= 0 )
+    {
+        printf("No clients left to volley after %d background clients, exiting...\n", gtp.background);
+        exit(0);
+    }
+    
     if( !gtp.clients_limited || (gtp.clients < gtp.client_limit) )
     {
         printf( "%d clients connected.\n", gtp.clients );
     }
 
+    printf( "Connect time for %d clients: %.3f msec from first connect, %.3f msec from listen.\n",
+        gtp.clients,
+        qpc_to_msec( acceptState.lastConnect - acceptState.firstConnect ),
+        qpc_to_msec( acceptState.lastConnect - acceptState.listenStart ) );
+}
+
+// forget the clients so the next run can accept them again
+void resetClients()
+{
+    for( auto h : clientThreads )
+    {
+        CloseHandle( h );
+    }
+
+    clientThreads.clear();
+    clientSockets.clear();
+    clientAddresses.clear();
+    clientInterfaces.clear();
+    clientResults.clear();
+    gtp.clients = 0;
+}
+
+// Run the test with the connected clients and report it.  Returns false,
+// having closed the connections, if clients changed their congestion
+// control and the run has to start over.
+bool runTest( TestSummary *summary )
+{
 #ifdef REPORT_ESTATS
     bool estats = enableTcpEStats();
     if( !estats )
@@ -518,14 +662,43 @@ void serverMain()
     }
 #endif
 
-    barrier b(gtp.clients);
+    barrier b(incastClients());
+    barrier ab(gtp.clients);
     pb = &b;
+    pab = &ab;
   
     clientResults.resize(gtp.clients);
+    ccState.reconnect = 0;
+    warmup.reset( incastClients() );
+    convergence.reset();
+    background.reset();
+    staggerReset();
 
-    for( int c = 0; c < gtp.clients; ++c )
+    if( gtp.reduce_op != REDUCE_NONE )
     {
-        clientThreads.push_back( 
+        reduceStart();
+    }
+
+    if( gtp.churn )
+    {
+        churnStart();
+    }
+
+    if( gtp.credit_on )
+    {
+        creditStart();
+    }
+
+    if( gtp.stripes > 1 )
+    {
+        stripeStart();
+    }
+
+    traceStart();
+
+    for( int c = 0; c < gtp.clients; ++c )
+    {
+        clientThreads.push_back( 
             (HANDLE) _beginthreadex( NULL, 0, serverThread, (void*) c, 0, NULL ) );
     }
 
@@ -534,18 +707,100 @@ void serverMain()
     HARD_ASSERT( clientThreads.size() == gtp.clients );
     
     // wait for all serverThreads to complete the test and exit
-    WaitForMultipleObjectsEx( gtp.clients, &clientThreads[0], true, INFINITE, FALSE );
+    waitForThreads( clientThreads );
+
+    if( gtp.reduce_op != REDUCE_NONE )
+    {
+        reduceStop();
+    }
+
+    if( gtp.churn )
+    {
+        churnStop();
+    }
+
+    if( gtp.credit_on )
+    {
+        creditStop();
+    }
+
+    if( gtp.stripes > 1 )
+    {
+        stripeStop();
+    }
+
+    traceStop();
+
+    if( ccState.reconnect )
+    {
+        printf( "\nClients changed their congestion control; starting over.\n" );
+
+        for( int c = 0; c < gtp.clients; ++c )
+        {
+            closesocket( clientSockets[c] );
+        }
+
+        return false;
+    }
     
     printf( "done!\n" );
     
-    GetTcpStatistics(&tcpStatsAfter);
+    getTcpStatistics(&tcpStatsAfter);
+    cpuAfter = getCpuTimes();
+
+    // the reports are about the volleys; the background clients come last
+    clientResults.resize( incastClients() );
+
+    // the reports go by the volleys actually run, which may be fewer
+    // than the budget if the run converged
+    const int budget = gtp.iters;
+    gtp.iters = (int) clientResults[0].measurements.size();
+
+    if( summary )
+    {
+        *summary = summarizeTest();
+    }
     
     reportGlobalTestParameters();
 
+    reportWarmup();
+
     reportLatencyThroughput();
 
+    reportConfidence();
+
+    reportBackground();
+
+    reportService();
+
+    reportReduce();
+
+    reportChurn();
+
+    reportCredit();
+
+    reportStagger();
+
+    reportStripes();
+
+    reportReleaseSkew();
+
+    reportStackLatency();
+
     reportTcpStats();
 
+    reportInterfaces();
+
+    reportCpu();
+
+    reportCounters();
+
+    reportIntegrity();
+
+    reportPlacement();
+
+    reportCongestion();
+
 #ifdef REPORT_ESTATS
     if( estats )
     {
@@ -557,61 +812,264 @@ void serverMain()
     {
         gracefulShutdown( clientSockets[c] );
     }
+
+    gtp.iters = budget;
+
+    return true;
 }
 
-void clientMain( char* server )
+// accept and run until a run completes
+void runUntilDone( bool first, TestSummary *summary )
 {
-    printf("Client mode\n");
-    
-    ULONG addr = inet_addr( server );
-    if (addr == INADDR_NONE)
+    while( true )
     {
-        PADDRINFOA pai;
-        if( getaddrinfo( server, NULL, NULL, &pai ) != 0 )
+        acceptClients( first );
+
+        if( first )
         {
-            fprintf(stderr, "getaddrinfo() failed: %d\n", WSAGetLastError());
-            exit(-1);
+            // later runs wait for the same clients
+            gtp.clients_limited = true;
+            gtp.client_limit = gtp.clients;
+            first = false;
         }
 
-        for( PADDRINFOA p = pai; p != NULL; p=p->ai_next )
+        bool done = runTest( summary );
+        resetClients();
+
+        if( done )
+            break;
+    }
+}
+
+// run the test with this many volleying clients and this fan-in size;
+// the first run connects the clients, all of which volley
+CollapsePoint collapseRun( int clients, int size, int connected, bool first )
+{
+    gtp.background = first ? 0 : connected - clients;
+    gtp.fi_msg_size = size;
+
+    if( first )
+        printf( "\nCollapse search: all clients, %d byte fan-in\n", size );
+    else
+        printf( "\nCollapse search: %d clients, %d byte fan-in\n", clients, size );
+
+    CollapsePoint p;
+    runUntilDone( first, &p.summary );
+
+    p.clients = first ? gtp.client_limit : clients;
+    p.size = size;
+    p.collapsed = false;
+
+    collapsePoints.push_back( p );
+    return p;
+}
+
+// serverMain: the largest point first, which connects the clients, then
+// the smallest, then bisect between them.  Assumes that past the
+// threshold it stays collapsed.
+void collapseSearch()
+{
+    const int size = gtp.fi_msg_size;
+
+    CollapsePoint top = collapseRun( 0, collapseBySize() ? gtp.collapse_max_size : size, 0, true );
+    const int connected = top.clients;
+
+    int lo = collapseBySize() ? size : 1;
+    int hi = collapseBySize() ? gtp.collapse_max_size : connected;
+
+    CollapsePoint base = collapseBySize() ?
+        collapseRun( connected, lo, connected, false ) :
+        collapseRun( lo, size, connected, false );
+
+    // nothing to bisect unless the largest point collapsed
+    const bool collapsed = isCollapsed( top, base );
+    collapsePoints.front().collapsed = collapsed;
+
+    if( collapsed )
+    {
+        while( !collapseNarrow( lo, hi ) )
+        {
+            int mid = collapseBySize() ? (int) sqrt( (double) lo * hi ) : (lo + hi) / 2;
+            mid = std::min( std::max( mid, lo + 1 ), hi - 1 );
+
+            CollapsePoint p = collapseBySize() ?
+                collapseRun( connected, mid, connected, false ) :
+                collapseRun( mid, size, connected, false );
+
+            // the verdict the report shows is the one the search acted on
+            collapsePoints.back().collapsed = isCollapsed( p, base );
+
+            if( collapsePoints.back().collapsed )
+                hi = mid;
+            else
+                lo = mid;
+        }
+    }
+
+    gtp.background = 0;
+    gtp.fi_msg_size = size;
+
+    reportCollapse( lo, hi, collapsed );
+}
+
+void serverMain()
+{
+    printf( "Server mode\n\n" );
+
+    InitializeCriticalSection( &acceptState.lock );
+    acceptState.limitReached = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+    if( gtp.background > 0 )
+    {
+        // the same test without and with the background streams
+        vector<TestSummary> runs( 2 );
+        vector<double> goodput( 2 );
+
+        serverSetCongestion();
+
+        for( int r = 0; r < 2; ++r )
+        {
+            gtp.background_on = (r == 1);
+
+            printf( "\nBackground flows %s\n", gtp.background_on ? "streaming" : "idle" );
+
+            runUntilDone( r == 0, &runs[r] );
+            goodput[r] = backgroundGoodput();
+        }
+
+        reportBackgroundComparison( runs, goodput );
+    }
+    else if( gtp.credit_window > 0 )
+    {
+        // the same test with plain and with credit-based fan-in
+        vector<TestSummary> runs( 2 );
+
+        serverSetCongestion();
+
+        for( int r = 0; r < 2; ++r )
         {
-            if( p->ai_family == AF_INET )
+            gtp.credit_on = (r == 1);
+
+            printf( "\nFan-in %s\n", gtp.credit_on ? "on credits" : "plain" );
+
+            runUntilDone( r == 0, &runs[r] );
+        }
+
+        reportCreditComparison( runs );
+    }
+    else if( gtp.collapse_line_mbps > 0 )
+    {
+        serverSetCongestion();
+        collapseSearch();
+    }
+    else if( gtp.stagger_tune || (gtp.stagger != STAGGER_NONE) )
+    {
+        // everyone at once first, then the policy or the candidates
+        StaggerSetting all = { STAGGER_NONE, 0, 0 };
+        StaggerSetting configured = { gtp.stagger, gtp.stagger_size, gtp.stagger_gap_usec };
+
+        stagger.runs.assign( 1, all );
+        if( !gtp.stagger_tune )
+        {
+            stagger.runs.push_back( configured );
+        }
+
+        vector<TestSummary> runs;
+
+        serverSetCongestion();
+
+        for( unsigned r = 0; r < stagger.runs.size(); ++r )
+        {
+            staggerApply( stagger.runs[r] );
+
+            printf( "\nFan-out %s\n", staggerDescription( stagger.runs[r] ).c_str() );
+
+            runs.push_back( TestSummary() );
+            runUntilDone( r == 0, &runs.back() );
+
+            if( (r == 0) && gtp.stagger_tune )
             {
-                PSOCKADDR_IN sai = (PSOCKADDR_IN) p->ai_addr;
-                addr = *(ULONG*) &(sai->sin_addr); 
-                break;
+                staggerCandidates( gtp.client_limit - gtp.background, runs[0] );
             }
         }
 
-        freeaddrinfo( pai );
+        reportStaggerComparison( runs );
+    }
+    else if( ccState.compare.empty() )
+    {
+        serverSetCongestion();
+        runUntilDone( true, NULL );
+    }
+    else
+    {
+        // the same test once per algorithm, all clients alike
+        vector<TestSummary> runs( ccState.compare.size() );
+
+        for( unsigned r = 0; r < ccState.compare.size(); ++r )
+        {
+            ccState.mix.assign( 1, ccState.compare[r] );
+            serverSetCongestion();
+
+            printf( "\nCongestion control %s (%u of %u)\n", ccState.compare[r].c_str(),
+                r + 1, (unsigned) ccState.compare.size() );
+
+            runUntilDone( r == 0, &runs[r] );
+        }
+
+        reportCongestionComparison( runs );
+    }
+
+    clearCongestionFilter();
+}
+
+void sendClientResults( SOCKET s, ClientResultData &crd )
+{
+    int bytes;
+    if ((bytes = send(s, (char*) &crd, sizeof(ClientResultData), 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() client results failed: %d\n", WSAGetLastError());
+        exit(-1);
     }
+    HARD_ASSERT(bytes == sizeof(ClientResultData));
+}
+
+void clientMain( char* server )
+{
+    printf("Client mode\n");
     
+    // in the family we connect from, if -la fixed one
+    SOCKADDR_INET addr = resolveServer( server, localAddress.si_family );
+    
+    // spread clients across the server's listen ports
+    const unsigned port = basePort + GetCurrentProcessId() % listenPorts;
+
     SOCKET s;
 
 beginTest:
     printf("\nCTRL-C to quit.\n");
 
-    if ((s = socket(PF_INET,SOCK_STREAM,0)) == INVALID_SOCKET)
+    SOCKADDR_INET sin = addr;
+    setAddressPort( sin, port );
+
+    if ((s = socket(sin.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
     {
         fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
         exit(-1);
     }
-    
-    SOCKADDR_IN sin = {0};
-    sin.sin_family = AF_INET;
-    sin.sin_port = htons(PORT);
-    sin.sin_addr.s_addr = addr;
 
-    char *ip = inet_ntoa(sin.sin_addr);
+    bindSourceAddress(s);
+
+    const string ipString( addressString(sin) );
+    const char *ip = ipString.c_str();
    
     if (strcmp(server,ip) == 0)
-        printf("Connecting to %s port %d...", server, PORT);	
+        printf("Connecting to %s port %u...", server, port);	
     else
-        printf("Connecting to %s (%s) port %d...", server, ip, PORT);	
+        printf("Connecting to %s (%s) port %u...", server, ip, port);	
 
     while (true)
     {
-        if (connect(s, (SOCKADDR*) &sin, sizeof(SOCKADDR)) != SOCKET_ERROR)
+        if (connect(s, (SOCKADDR*) &sin, addressLength(sin)) != SOCKET_ERROR)
         {
             break;
         }
@@ -631,14 +1089,7 @@ beginTest:
 
     printf("connected!\n");
             
-    if( gtp.nagle == false )
-        disableNagle(s);
-            
-    if( gtp.send_buffer >= 0 )
-        setSocketBufferSize(s, SO_SNDBUF, gtp.send_buffer );
-
-    if( gtp.recv_buffer >= 0 )
-        setSocketBufferSize(s, SO_RCVBUF, gtp.recv_buffer );
+    applySocketOptions(s);
 
     int bytes;
 
@@ -658,80 +1109,305 @@ beginTest:
         exit(-1);
     }
     HARD_ASSERT(bytes == sizeof(ClientSpecificTestParameters));
+
+    if( !clientCongestionHandshake( s, cstp, port ) )
+    {
+        closesocket(s);
+        goto beginTest;
+    }
+
+    ClientResultData crd;
+    gethostname( crd.host, sizeof(crd.host) );
+
+    unpinThread();
+    applyPlacement( gtp.client_placement, cstp.client_num, s, crd.placement );
+
+    if( isBackgroundClient( cstp.client_num ) )
+    {
+        printf( "\nStreaming in the background..." );
+        clientStream( s );
+        printf( "done!\n" );
+
+        sendClientResults( s, crd );
+        gracefulShutdown(s);
+        goto beginTest;
+    }
+
+    ShuffleMesh mesh;
+    if( gtp.shuffle )
+    {
+        shuffleBuildMesh( s, cstp.client_num, mesh );
+    }
+
+    ClientStripes clientStripes;
+    if( gtp.stripes > 1 )
+    {
+        clientStripeConnect( sin, s, cstp.client_num, clientStripes );
+    }
+
+    // in shuffle mode the fan-in goes to our peers, and the server
+    // only gets told when the round is done
+    const int fi_size = gtp.shuffle ? SHUFFLE_DONE_MSG_SIZE : gtp.fi_msg_size;
    
-    unique_ptr<char[]> fobuf( new char[gtp.fo_msg_size] );
-    unique_ptr<char[]> fibuf( new char[gtp.fi_msg_size] );
+    LocalBuffer fobuf( allocLocalBuffer( gtp.fo_msg_size, crd.placement ) );
+    LocalBuffer fibuf( allocLocalBuffer( gtp.fi_msg_size, crd.placement ) );
+
+    if( gtp.verify )
+    {
+        fillPayload( fibuf.get(), gtp.fi_msg_size, cstp.client_num, -1 );
+    }
+
+    if( (gtp.reduce_op != REDUCE_NONE) && !gtp.verify )
+    {
+        fillReduceValues( fibuf.get(), gtp.fi_msg_size, cstp.client_num );
+    }
+
+    ServiceEmulator service( cstp.client_num );
+    vector<int> serviceUsec;
+    serviceUsec.reserve( gtp.iters );
 
     printf( "\nWarming Up..." );
     
-    for( int i = 0; i < WARMUP_ITERS; ++i )
+    for( int i = 0; ; ++i )
     {
+        // the server decides when warm-up is over
+        if( gtp.warmup_cap > 0 )
+        {
+            char phase;
+            if ((bytes = recvMessage(s, &phase, 1)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "recv() warm-up phase failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == 1);
+
+            if( phase == WARMUP_DONE )
+                break;
+        }
+        else if( i == WARMUP_ITERS )
+        {
+            break;
+        }
+
         // expect the fan-out
-        if ((bytes = recv(s, fobuf.get(), gtp.fo_msg_size, MSG_WAITALL)) == SOCKET_ERROR)
+        if ((bytes = recvMessage(s, fobuf.get(), gtp.fo_msg_size)) == SOCKET_ERROR)
         {
             fprintf(stderr, "recv() fan-out failed: %d\n", WSAGetLastError());
             exit(-1);
         }
         HARD_ASSERT(bytes == gtp.fo_msg_size);
+
+        service.serve();
+
+        if( gtp.shuffle )
+        {
+            shuffleExchange( mesh, fibuf.get() );
+        }
        
         // send the fan-in
-        if ((bytes = send(s, fibuf.get(), gtp.fi_msg_size, 0)) == SOCKET_ERROR)
+        if( gtp.stripes > 1 )
         {
-            fprintf(stderr, "send() fan-in failed: %d\n", WSAGetLastError());
-            exit(-1);
+            clientStripeFanIn( clientStripes, fibuf.get(), fi_size );
+        }
+        else
+        {
+            if ((bytes = send(s, fibuf.get(), fi_size, 0)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "send() fan-in failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == fi_size);
+        }
+
+        if( gtp.verify )
+        {
+            clientCheckPayloads( crd, fobuf.get(), fibuf.get(), cstp.client_num, -1 - i, -2 - i );
         }
-        HARD_ASSERT(bytes == gtp.fi_msg_size);
+    }
+
+    if( gtp.verify )
+    {
+        fillPayload( fibuf.get(), gtp.fi_msg_size, cstp.client_num, 0 );
     }
     
     printf( "done!\nTesting..." );
 
+    // only time the verification of measured volleys
+    crd.verify_usec = 0;
+
     MIB_TCPSTATS tcpStatsBefore, tcpStatsAfter;
-    GetTcpStatistics(&tcpStatsBefore);
+    getTcpStatistics(&tcpStatsBefore);
+    CpuTimes cpuBefore = getCpuTimes();
+
+    if( gtp.host_counters )
+    {
+        countersThreadStart( crd.counters );
+        takeCounterSnapshot( countersBefore );
+    }
 
     for( int i = 0; i < gtp.iters; ++i )
     {
+        // the server may stop early once the run has converged
+        if( (gtp.converge_percentile > 0) && (i > 0) && (i % CONVERGE_INTERVAL == 0) )
+        {
+            char phase;
+            if ((bytes = recvMessage(s, &phase, 1)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "recv() convergence phase failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == 1);
+
+            if( phase == CONVERGE_STOP )
+                break;
+        }
+
         // expect the fan-out
-        if ((bytes = recv(s, fobuf.get(), gtp.fo_msg_size, MSG_WAITALL)) == SOCKET_ERROR)
+        if ((bytes = recvMessage(s, fobuf.get(), gtp.fo_msg_size)) == SOCKET_ERROR)
         {
             fprintf(stderr, "recv() fan-out failed: %d\n", WSAGetLastError());
             exit(-1);
         }
         HARD_ASSERT(bytes == gtp.fo_msg_size);
+
+        // the work a leaf does before it answers
+        if( gtp.service_model != SERVICE_NONE )
+        {
+            serviceUsec.push_back( service.serve() );
+        }
+
+        if( gtp.shuffle )
+        {
+            shuffleExchange( mesh, fibuf.get() );
+        }
       
-        // send the fan-in
-        if ((bytes = send(s, fibuf.get(), gtp.fi_msg_size, 0)) == SOCKET_ERROR)
+        // send the fan-in, on a new connection if churning, as credits
+        // come in, or over the stripes
+        if( gtp.churn )
         {
-            fprintf(stderr, "send() fan-in failed: %d\n", WSAGetLastError());
-            exit(-1);
+            clientChurnFanIn( sin, cstp.client_num, i, fibuf.get(), fi_size );
+        }
+        else if( gtp.credit_on )
+        {
+            clientCreditFanIn( s, fibuf.get(), fi_size );
+        }
+        else if( gtp.stripes > 1 )
+        {
+            clientStripeFanIn( clientStripes, fibuf.get(), fi_size );
+        }
+        else
+        {
+            if ((bytes = send(s, fibuf.get(), fi_size, 0)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "send() fan-in failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+            HARD_ASSERT(bytes == fi_size);
+        }
+
+        if( gtp.verify )
+        {
+            clientCheckPayloads( crd, fobuf.get(), fibuf.get(), cstp.client_num, i, i + 1 );
+        }
+
+        if( gtp.host_counters )
+        {
+            countersVolley( crd.counters );
         }
-        HARD_ASSERT(bytes == gtp.fi_msg_size);
 
         //printf( "." );
     }
 
     printf( "done!\n" );
 
-    GetTcpStatistics(&tcpStatsAfter);
+    getTcpStatistics(&tcpStatsAfter);
+    crd.cpu = getCpuTimes() - cpuBefore;
+
+    if( gtp.host_counters )
+    {
+        clientCountersStop( crd.counters );
+    }
+
+    shuffleCloseMesh( mesh );
+    clientStripeClose( clientStripes );
 
     // ISSUE-REVIEW
     // This is a system-wide statistic for all TCP connections.  Can I get a
     // per-connection equivalent with GetPerTcpConnectionEStats or another API?
-    ClientResultData crd;
     crd.retransmits = tcpStatsAfter.dwRetransSegs - tcpStatsBefore.dwRetransSegs;
 
-    // send client results
-    if ((bytes = send(s, (char*) &crd, sizeof(ClientResultData), 0)) == SOCKET_ERROR)
+    sendClientResults( s, crd );
+
+    if( gtp.service_model != SERVICE_NONE )
     {
-        fprintf(stderr, "send() client results failed: %d\n", WSAGetLastError());
-        exit(-1);
+        sendServiceTimes( s, serviceUsec );
     }
-    HARD_ASSERT(bytes == sizeof(ClientResultData));
 
     gracefulShutdown(s);
 
     goto beginTest;
 }
 
+void simulateMain()
+{
+    printf( "Simulation mode\n" );
+
+    gtp.clients = simParams.clients;
+    clientResults.resize( gtp.clients );
+
+    for( int c = 0; c < gtp.clients; ++c )
+    {
+        clientResults[c].measurements.reserve( gtp.iters );
+    }
+
+    IncastSimulator sim;
+
+    printf( "\nSimulating..." );
+
+    __int64 start = qpc();
+    sim.run();
+    double wallSeconds = ((double) (qpc() - start)) / freq;
+
+    traceStart();
+    traceStop();
+
+    printf( "done!\n" );
+
+    reportGlobalTestParameters();
+
+    reportLatencyThroughput();
+
+    reportConfidence();
+
+    reportSimulation( sim, wallSeconds );
+}
+
+void relayMain( char* server )
+{
+    printf( "Relay mode\n" );
+
+    SOCKADDR_INET sin = resolveServer( server );
+
+    // clients reach an IPv6 server through us in either family
+    SOCKADDR_INET any = {0};
+    any.si_family = sin.si_family;
+
+    vector<SOCKET> listeners;
+    for( int k = 0; k < listenPorts; ++k )
+    {
+        listeners.push_back( createListener( relayParams.port + k, 65535, &any, true ) );
+    }
+
+    printf( "Relaying ports %u-%u to %s ports %u-%u through %.0f mbit/sec, %d bytes buffered\n",
+        relayParams.port, relayParams.port + listenPorts - 1,
+        addressString( sin ).c_str(), basePort, basePort + listenPorts - 1,
+        relayParams.rate_mbps, relayParams.buffer );
+    printf( "\nCTRL-C to quit.\n" );
+
+    BottleneckRelay relay( listeners, sin );
+    relay.run();
+}
+
 void usage()
 {
     fprintf(stderr, "\
@@ -747,8 +1423,25 @@ at the server.\n\
 Clients will connect to the server, run a test, and loop forever. Each server\n\
 invocation represents a new test.\n\
 \n\
-For client mode, the only argument is the server IP or name:\n\
-    INCAST.EXE <server>\n\
+For client mode, the first argument is the server IP or name:\n\
+    INCAST.EXE <server> <client options>\n\
+\n\
+Available <client options> and their default values:\n\
+    -p  PORT   Server base port (%d)\n\
+    -lp NUM    Spread clients across NUM server ports (1)\n\
+    -la ADDR   Connect from local address ADDR, IPv4 or IPv6, or from the\n\
+               first address of interface ADDR, by name or index (any)\n\
+\n\
+To reproduce incast without a switch, run a relay between the clients and\n\
+the server, and point the clients at the relay:\n\
+    INCAST.EXE -relay <server> <relay options>\n\
+\n\
+Available <relay options> and their default values:\n\
+    -p  PORT   Server base port (%d)\n\
+    -lp NUM    Number of server ports to relay (1)\n\
+    -rp PORT   Relay base listen port (%d)\n\
+    -q  MBPS   Egress rate toward the server (%.0f)\n\
+    -qb BYTES  Egress queue size; full queues back-pressure the clients (%d)\n\
 \n\
 Test options are specified only on the server side:\n\
     INCAST.EXE <options>\n\
@@ -763,9 +1456,75 @@ Available <options> and their default values:\n\
     -o  SIZE   Fan-out message size (%d)\n\
     -i  SIZE   Fan-in message size (%d)\n\
     -f  FILE   Dump full histogram to file\n\
+    -tr  FILE  Append every volley to FILE as it runs, for ANALYZE.EXE (disabled)\n\
+    -trc FILE  The same with every client's part of each volley (disabled)\n\
     -j  MSEC   Delay clients via random jitter (disabled)\n\
-    -s  MSEC   Delay clients via uniform scheduling (disabled)\n", 
-    DEFAULT_ITERS, DEFAULT_FO_MSG_SIZE, DEFAULT_FI_MSG_SIZE );
+    -s  MSEC   Delay clients via uniform scheduling (disabled)\n\
+    -fb B USEC Send the fan-outs in batches of B clients, USEC apart (disabled)\n\
+    -fw K      Keep at most K clients answering, sending the next fan-out\n\
+               as each fan-in arrives (disabled)\n\
+    -ft        Try batches and windows of halving size and report the best;\n\
+               each runs -n volleys (disabled)\n\
+    -xc MBPS   Find where the volleys collapse as clients are added, against\n\
+               a line rate of MBPS; each point runs -n volleys (disabled)\n\
+    -xi MBPS MAX  Same, as the fan-in grows from -i to MAX bytes (disabled)\n\
+    -xf PCT    Collapsed below PCT percent of the line rate (%.0f)\n\
+    -sh        All-to-all shuffle between clients, -i SIZE per peer (disabled)\n\
+    -st NUM    Each client stripes its fan-in over NUM connections, the\n\
+               others to port %u (1)\n\
+    -churn NUM Send every fan-in on a new connection to port %u,\n\
+               listening with a backlog of NUM (disabled)\n\
+    -cw BYTES  Fan-in on credits, at most BYTES granted across the clients;\n\
+               the test runs plain, then on credits, with Nagle off (disabled)\n\
+    -ck BYTES  Fan-in chunk size per credit (%d)\n\
+    -co ORDER  Credit order: rr or srf, shortest remaining first (rr)\n\
+    -rd  OP    Reduce each fan-in as floats with SSE: sum, minmax or topk (none)\n\
+    -rdp NUM   Reduce on a pool of NUM threads instead of inline (inline)\n\
+    -svc MODEL N  Client work before each fan-in: fixed N usec, exp with a\n\
+               mean of N usec, or hash N bytes; reported and subtracted (none)\n\
+    -p  PORT   Base listen port (%d)\n\
+    -lp NUM    Number of listen ports, starting at the base port (1)\n\
+    -at NUM    Accept threads per listen port (1)\n\
+    -bind LIST Listen on a comma-separated LIST of local addresses or\n\
+               interfaces, IPv4 or IPv6; results are grouped by the\n\
+               interface each client connected to (all IPv4)\n\
+    -pin  SPEC Pin server threads: numa, rss, or a core list like 0-7,16 (none)\n\
+    -cpin SPEC Pin client threads, same SPEC choices (none)\n\
+    -bp USEC   Busy-poll receives for USEC before blocking (disabled)\n\
+    -bs USEC   Reject a run, exiting with 2, whose 99th percentile barrier\n\
+               release skew is above USEC (none)\n\
+    -pc        Report cycles, context switches, migrations and DPC time\n\
+               per volley on the server and clients (disabled)\n\
+    -v         Verify payloads with CRC32C, -o and -i at least %d (disabled)\n\
+    -ts        Report the stack's RTT next to the measured latency (disabled)\n\
+    -cc  LIST  Congestion control: default, cubic, dctcp, ctcp, newreno or bbr2;\n\
+               a comma-separated LIST is dealt round robin to the clients.\n\
+               Needs admin and one incast per host (default)\n\
+    -cmp LIST  Run the test once per algorithm in LIST and compare them (disabled)\n\
+    -local NUM Launch NUM clients on this host, each on its own loopback\n\
+               address, and test with them (disabled)\n\
+    -lq  MBPS  Put the local clients behind a relay at MBPS (no relay)\n\
+    -lqb BYTES Egress queue size of that relay (%d)\n\
+    -w  CAP    Warm up until latency is steady, at most CAP volleys (%d volleys)\n\
+    -ci        Report 95%% confidence intervals for the percentiles (disabled)\n\
+    -cs P PCT  Stop once the Pth percentile's interval is within PCT percent\n\
+               of it, checked every %d volleys; -n is then the budget (disabled)\n\
+    -bg  NUM   The last NUM clients stream in the background instead of\n\
+               volleying; the test runs without, then with them (disabled)\n\
+    -bgr MBPS  Cap each background stream at MBPS (no cap)\n\
+\n\
+Simulation options, to run the test through a model instead of a network:\n\
+    -sim NUM   Simulate NUM clients behind one switch port (disabled)\n\
+    -sq BYTES  Switch port buffer size (%d)\n\
+    -sl MBPS   Link speed (%.0f)\n\
+    -sr USEC   Base round trip time (%.0f)\n\
+    -so MSEC   TCP minimum retransmission timeout (%.0f)\n", 
+    PORT, PORT, RELAY_PORT, relayParams.rate_mbps, relayParams.buffer,
+    DEFAULT_ITERS, DEFAULT_FO_MSG_SIZE, DEFAULT_FI_MSG_SIZE, COLLAPSE_DEFAULT_FRACTION * 100,
+    PORT + STRIPE_PORT_OFFSET, PORT + CHURN_PORT_OFFSET,
+    CREDIT_DEFAULT_CHUNK, PORT,
+    MIN_VERIFIED_MSG_SIZE, launcherParams.buffer, WARMUP_ITERS, CONVERGE_INTERVAL, simParams.buffer, simParams.link_mbps,
+    simParams.rtt_usec, simParams.min_rto_msec );
 
     exit(-1);
 }
@@ -794,8 +1553,161 @@ int __cdecl main( int argc, char** argv )
     }
 
     // ISSUE-REVIEW: Switch to something standard like getopt
-    if ((argc == 2) && (argv[1][0] != '-') && (argv[1][0] != '/'))
+    if ((argc >= 3) && (strcmp(argv[1]+1, "relay") == 0))
+    {
+        for( int a = 3; a < argc; ++a )
+        {
+            if ((argv[a][0] != '-') && (argv[a][0] != '/')) 
+            {
+                usage();
+            }
+
+            switch (argv[a][1])
+            {
+                case 'p':
+                    a++;
+                    basePort = atoi(argv[a]);
+                    if( basePort <= 0 || basePort > 65535 )
+                    {
+                        fprintf(stderr, "-p parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+
+                case 'l':
+                    {
+                        if( strcmp( argv[a]+1, "lp" ) == 0 )
+                        {
+                            a++;
+                            listenPorts = atoi(argv[a]);
+                            if( listenPorts <= 0 )
+                            {
+                                fprintf(stderr, "-lp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'r':
+                    {
+                        if( strcmp( argv[a]+1, "rp" ) == 0 )
+                        {
+                            a++;
+                            relayParams.port = atoi(argv[a]);
+                            if( relayParams.port <= 0 || relayParams.port > 65535 )
+                            {
+                                fprintf(stderr, "-rp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'q':
+                    {
+                        if( argv[a][2] == NULL )
+                        {
+                            a++;
+                            relayParams.rate_mbps = atof(argv[a]);
+                            if( relayParams.rate_mbps <= 0 )
+                            {
+                                fprintf(stderr, "-q parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( argv[a][2] == 'b' )
+                        {
+                            a++;
+                            relayParams.buffer = atoi(argv[a]);
+                            if( relayParams.buffer < RELAY_SEGMENT )
+                            {
+                                fprintf(stderr, "-qb parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                default:
+                    fprintf(stderr, "Unknown command line option\n\n");
+                    usage();
+            }
+        }
+
+        relayMain( argv[2] );
+    }
+    else if ((argc >= 2) && (argv[1][0] != '-') && (argv[1][0] != '/'))
     {
+        for( int a = 2; a < argc; ++a )
+        {
+            if ((argv[a][0] != '-') && (argv[a][0] != '/')) 
+            {
+                usage();
+            }
+
+            switch (argv[a][1])
+            {
+                case 'p':
+                    a++;
+                    basePort = atoi(argv[a]);
+                    if( basePort <= 0 || basePort > 65535 )
+                    {
+                        fprintf(stderr, "-p parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+
+                case 'l':
+                    {
+                        if( strcmp( argv[a]+1, "la" ) == 0 )
+                        {
+                            a++;
+                            if( !parseSourceAddress( argv[a], localAddress ) )
+                            {
+                                fprintf(stderr, "-la parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "lp" ) == 0 )
+                        {
+                            a++;
+                            listenPorts = atoi(argv[a]);
+                            if( listenPorts <= 0 )
+                            {
+                                fprintf(stderr, "-lp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                default:
+                    fprintf(stderr, "Unknown command line option\n\n");
+                    usage();
+            }
+        }
+
         clientMain( argv[1] );
     }
     else
@@ -846,6 +1758,25 @@ int __cdecl main( int argc, char** argv )
                                 exit(-1);
                             }
                         }
+                        else if( strcmp( argv[a]+1, "rd" ) == 0 )
+                        {
+                            a++;
+                            if( !parseReduceOp( argv[a], gtp.reduce_op ) )
+                            {
+                                fprintf(stderr, "-rd parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "rdp" ) == 0 )
+                        {
+                            a++;
+                            gtp.reduce_threads = atoi(argv[a]);
+                            if( gtp.reduce_threads <= 0 )
+                            {
+                                fprintf(stderr, "-rdp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
                         else if( argv[a][2] == 'b' )
                         {
                             a++;
@@ -887,6 +1818,86 @@ int __cdecl main( int argc, char** argv )
                                 exit(-1);
                             }
                         }
+                        else if( argv[a][2] == 'h' )
+                        {
+                            gtp.shuffle = true;
+                        }
+                        else if( strcmp( argv[a]+1, "st" ) == 0 )
+                        {
+                            a++;
+                            gtp.stripes = atoi(argv[a]);
+                            if( gtp.stripes <= 0 )
+                            {
+                                fprintf(stderr, "-st parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "svc" ) == 0 )
+                        {
+                            a++;
+                            if( !parseServiceModel( argv[a], gtp.service_model ) )
+                            {
+                                fprintf(stderr, "-svc model invalid\n");
+                                exit(-1);
+                            }
+                            a++;
+                            gtp.service_param = atoi(argv[a]);
+                            if( gtp.service_param <= 0 )
+                            {
+                                fprintf(stderr, "-svc parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "sim" ) == 0 )
+                        {
+                            a++;
+                            simParams.clients = atoi(argv[a]);
+                            if( simParams.clients <= 0 )
+                            {
+                                fprintf(stderr, "-sim parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( argv[a][2] == 'q' )
+                        {
+                            a++;
+                            simParams.buffer = atoi(argv[a]);
+                            if( simParams.buffer < SIM_MSS + SIM_HEADER_BYTES )
+                            {
+                                fprintf(stderr, "-sq parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( argv[a][2] == 'l' )
+                        {
+                            a++;
+                            simParams.link_mbps = atof(argv[a]);
+                            if( simParams.link_mbps <= 0 )
+                            {
+                                fprintf(stderr, "-sl parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( argv[a][2] == 'r' )
+                        {
+                            a++;
+                            simParams.rtt_usec = atof(argv[a]);
+                            if( simParams.rtt_usec < 0 )
+                            {
+                                fprintf(stderr, "-sr parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( argv[a][2] == 'o' )
+                        {
+                            a++;
+                            simParams.min_rto_msec = atof(argv[a]);
+                            if( simParams.min_rto_msec <= 0 )
+                            {
+                                fprintf(stderr, "-so parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
                         else
                         {
                             fprintf(stderr, "Unknown command line option\n\n");
@@ -896,60 +1907,583 @@ int __cdecl main( int argc, char** argv )
                     break;
                 
                 case 'c':
-                    a++;
-                    gtp.clients_limited = true;
-                    gtp.client_limit = atoi(argv[a]);
-                    if( gtp.client_limit <= 0 )
-                    {
-                        fprintf(stderr, "-c parameter invalid\n");
-                        exit(-1);
-                    }
-                    break;
-
-                case 'n':
-                    a++;
-                    gtp.iters = atoi(argv[a]);
-                    if( gtp.iters <= 0 )
-                    {
-                        fprintf(stderr, "-n parameter invalid\n");
-                        exit(-1);
-                    }
-                    break;
-                
-                case 'd':
-                    gtp.nagle = false;
-                    break;
-                
-                case 'f':
-                    a++;
-                    gtp.histogram = true;
-                    // ISSUE-REVIEW: Overwriting existing files?
-                    histfile.open(argv[a]);
-                    if( !histfile.good() )
-                    {
-                        fprintf(stderr, "-f parameter invalid\n");
-                        exit(-1);
-                    }
-                    break;
-                
-                case 'j':
-                    a++;
-                    gtp.delay = atoi(argv[a]);
-                    gtp.delay_method = RANDOM_JITTER;
-                    if( gtp.delay <= 0 )
                     {
-                        fprintf(stderr, "-j parameter invalid\n");
-                        exit(-1);
-                    }
-                    break;
-                   
-                default:
-                    fprintf(stderr, "Unknown command line option\n\n");
-                    usage();
+                        if( argv[a][2] == NULL )
+                        {
+                            a++;
+                            gtp.clients_limited = true;
+                            gtp.client_limit = atoi(argv[a]);
+                            if( gtp.client_limit <= 0 )
+                            {
+                                fprintf(stderr, "-c parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "cc" ) == 0 )
+                        {
+                            a++;
+                            if( !parseCongestionList( argv[a], ccState.mix ) )
+                            {
+                                fprintf(stderr, "-cc parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "cmp" ) == 0 )
+                        {
+                            a++;
+                            if( !parseCongestionList( argv[a], ccState.compare ) )
+                            {
+                                fprintf(stderr, "-cmp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "cpin" ) == 0 )
+                        {
+                            // checked against the clients' cores when they apply it
+                            a++;
+                            if( strlen(argv[a]) >= sizeof(gtp.client_placement) )
+                            {
+                                fprintf(stderr, "-cpin parameter invalid\n");
+                                exit(-1);
+                            }
+                            strcpy_s( gtp.client_placement, sizeof(gtp.client_placement), argv[a] );
+                        }
+                        else if( strcmp( argv[a]+1, "churn" ) == 0 )
+                        {
+                            a++;
+                            gtp.churn = true;
+                            gtp.churn_backlog = atoi(argv[a]);
+                            if( gtp.churn_backlog <= 0 )
+                            {
+                                fprintf(stderr, "-churn parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "cw" ) == 0 )
+                        {
+                            a++;
+                            gtp.credit_window = atoi(argv[a]);
+                            if( gtp.credit_window <= 0 )
+                            {
+                                fprintf(stderr, "-cw parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "ck" ) == 0 )
+                        {
+                            a++;
+                            gtp.credit_chunk = atoi(argv[a]);
+                            if( gtp.credit_chunk <= 0 )
+                            {
+                                fprintf(stderr, "-ck parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "co" ) == 0 )
+                        {
+                            a++;
+                            if( strcmp( argv[a], "srf" ) == 0 )
+                            {
+                                gtp.credit_srf = true;
+                            }
+                            else if( strcmp( argv[a], "rr" ) != 0 )
+                            {
+                                fprintf(stderr, "-co parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "ci" ) == 0 )
+                        {
+                            gtp.confidence = true;
+                        }
+                        else if( strcmp( argv[a]+1, "cs" ) == 0 )
+                        {
+                            a++;
+                            gtp.converge_percentile = atoi(argv[a]);
+                            a++;
+                            gtp.converge_width = atof(argv[a]) / 100;
+                            if( (gtp.converge_percentile < 1) || (gtp.converge_percentile > 99) ||
+                                (gtp.converge_width <= 0) )
+                            {
+                                fprintf(stderr, "-cs parameters invalid\n");
+                                exit(-1);
+                            }
+                            gtp.confidence = true;
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'x':
+                    {
+                        if( strcmp( argv[a]+1, "xc" ) == 0 )
+                        {
+                            a++;
+                            gtp.collapse_line_mbps = atoi(argv[a]);
+                            if( gtp.collapse_line_mbps <= 0 )
+                            {
+                                fprintf(stderr, "-xc parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "xi" ) == 0 )
+                        {
+                            a++;
+                            gtp.collapse_line_mbps = atoi(argv[a]);
+                            a++;
+                            gtp.collapse_max_size = atoi(argv[a]);
+                            if( (gtp.collapse_line_mbps <= 0) || (gtp.collapse_max_size <= 0) )
+                            {
+                                fprintf(stderr, "-xi parameters invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "xf" ) == 0 )
+                        {
+                            a++;
+                            gtp.collapse_fraction = atof(argv[a]) / 100;
+                            if( (gtp.collapse_fraction <= 0) || (gtp.collapse_fraction >= 1) )
+                            {
+                                fprintf(stderr, "-xf parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'n':
+                    a++;
+                    gtp.iters = atoi(argv[a]);
+                    if( gtp.iters <= 0 )
+                    {
+                        fprintf(stderr, "-n parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+                
+                case 'd':
+                    gtp.nagle = false;
+                    break;
+                
+                case 'f':
+                    {
+                        if( argv[a][2] == NULL )
+                        {
+                            a++;
+                            gtp.histogram = true;
+                            // ISSUE-REVIEW: Overwriting existing files?
+                            histfile.open(argv[a]);
+                            if( !histfile.good() )
+                            {
+                                fprintf(stderr, "-f parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "fb" ) == 0 )
+                        {
+                            a++;
+                            gtp.stagger = STAGGER_BATCH;
+                            gtp.stagger_size = atoi(argv[a]);
+                            a++;
+                            gtp.stagger_gap_usec = atoi(argv[a]);
+                            if( (gtp.stagger_size <= 0) || (gtp.stagger_gap_usec <= 0) )
+                            {
+                                fprintf(stderr, "-fb parameters invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "fw" ) == 0 )
+                        {
+                            a++;
+                            gtp.stagger = STAGGER_WINDOW;
+                            gtp.stagger_size = atoi(argv[a]);
+                            if( gtp.stagger_size <= 0 )
+                            {
+                                fprintf(stderr, "-fw parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "ft" ) == 0 )
+                        {
+                            gtp.stagger_tune = true;
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+                
+                case 'p':
+                    {
+                        if( argv[a][2] == NULL )
+                        {
+                            a++;
+                            basePort = atoi(argv[a]);
+                            if( basePort <= 0 || basePort > 65535 )
+                            {
+                                fprintf(stderr, "-p parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "pin" ) == 0 )
+                        {
+                            a++;
+                            if( strlen(argv[a]) >= sizeof(gtp.placement) ||
+                                !isValidPlacement(argv[a]) )
+                            {
+                                fprintf(stderr, "-pin parameter invalid\n");
+                                exit(-1);
+                            }
+                            strcpy_s( gtp.placement, sizeof(gtp.placement), argv[a] );
+                        }
+                        else if( strcmp( argv[a]+1, "pc" ) == 0 )
+                        {
+                            gtp.host_counters = true;
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'l':
+                    {
+                        if( strcmp( argv[a]+1, "local" ) == 0 )
+                        {
+                            a++;
+                            launcherParams.clients = atoi(argv[a]);
+                            if( launcherParams.clients <= 0 )
+                            {
+                                fprintf(stderr, "-local parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "lq" ) == 0 )
+                        {
+                            a++;
+                            launcherParams.rate_mbps = atof(argv[a]);
+                            if( launcherParams.rate_mbps <= 0 )
+                            {
+                                fprintf(stderr, "-lq parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "lqb" ) == 0 )
+                        {
+                            a++;
+                            launcherParams.buffer = atoi(argv[a]);
+                            if( launcherParams.buffer < RELAY_SEGMENT )
+                            {
+                                fprintf(stderr, "-lqb parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "lp" ) == 0 )
+                        {
+                            a++;
+                            listenPorts = atoi(argv[a]);
+                            if( listenPorts <= 0 )
+                            {
+                                fprintf(stderr, "-lp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'a':
+                    a++;
+                    acceptThreadsPerPort = atoi(argv[a]);
+                    if( acceptThreadsPerPort <= 0 )
+                    {
+                        fprintf(stderr, "-at parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+
+                case 'b':
+                    {
+                        if( strcmp( argv[a]+1, "bg" ) == 0 )
+                        {
+                            a++;
+                            gtp.background = atoi(argv[a]);
+                            if( gtp.background <= 0 )
+                            {
+                                fprintf(stderr, "-bg parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "bgr" ) == 0 )
+                        {
+                            a++;
+                            gtp.background_mbps = atoi(argv[a]);
+                            if( gtp.background_mbps <= 0 )
+                            {
+                                fprintf(stderr, "-bgr parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "bs" ) == 0 )
+                        {
+                            a++;
+                            releaseSkew.threshold_usec = atof(argv[a]);
+                            if( releaseSkew.threshold_usec <= 0 )
+                            {
+                                fprintf(stderr, "-bs parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "bind" ) == 0 )
+                        {
+                            a++;
+                            if( !parseBindAddresses( argv[a], bindAddresses ) )
+                            {
+                                fprintf(stderr, "-bind parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "bp" ) == 0 )
+                        {
+                            a++;
+                            gtp.busy_poll_usec = atoi(argv[a]);
+                            if( gtp.busy_poll_usec <= 0 )
+                            {
+                                fprintf(stderr, "-bp parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'v':
+                    gtp.verify = true;
+                    break;
+
+                case 't':
+                    {
+                        if( (strcmp( argv[a]+1, "tr" ) == 0) || (strcmp( argv[a]+1, "trc" ) == 0) )
+                        {
+                            trace.per_client = (argv[a][3] == 'c');
+                            a++;
+                            if( !traceOpen( argv[a] ) )
+                            {
+                                fprintf(stderr, "-tr parameter invalid\n");
+                                exit(-1);
+                            }
+                        }
+                        else if( strcmp( argv[a]+1, "ts" ) == 0 )
+                        {
+                            gtp.stack_timing = true;
+                        }
+                        else
+                        {
+                            fprintf(stderr, "Unknown command line option\n\n");
+                            usage();
+                        }
+                    }
+                    break;
+
+                case 'w':
+                    a++;
+                    gtp.warmup_cap = atoi(argv[a]);
+                    if( gtp.warmup_cap <= 0 )
+                    {
+                        fprintf(stderr, "-w parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+
+                case 'j':
+                    a++;
+                    gtp.delay = atoi(argv[a]);
+                    gtp.delay_method = RANDOM_JITTER;
+                    if( gtp.delay <= 0 )
+                    {
+                        fprintf(stderr, "-j parameter invalid\n");
+                        exit(-1);
+                    }
+                    break;
+                   
+                default:
+                    fprintf(stderr, "Unknown command line option\n\n");
+                    usage();
             }
         }
 
-        serverMain();
+        if( gtp.verify )
+        {
+            if( (gtp.fo_msg_size < MIN_VERIFIED_MSG_SIZE) ||
+                (gtp.fi_msg_size < MIN_VERIFIED_MSG_SIZE) )
+            {
+                fprintf(stderr, "-v needs -o and -i of at least %d bytes\n", MIN_VERIFIED_MSG_SIZE);
+                exit(-1);
+            }
+
+            if( gtp.shuffle )
+            {
+                fprintf(stderr, "-v cannot be combined with -sh\n");
+                exit(-1);
+            }
+        }
+
+        if( !ccState.mix.empty() && !ccState.compare.empty() )
+        {
+            fprintf(stderr, "-cc cannot be combined with -cmp\n");
+            exit(-1);
+        }
+
+        // the transport filters only cover the test ports
+        if( (!ccState.mix.empty() || !ccState.compare.empty()) && (gtp.churn || (gtp.stripes > 1)) )
+        {
+            fprintf(stderr, "-cc and -cmp cannot be combined with -churn or -st\n");
+            exit(-1);
+        }
+
+        if( (gtp.reduce_op != REDUCE_NONE) && gtp.shuffle )
+        {
+            fprintf(stderr, "-rd cannot be combined with -sh\n");
+            exit(-1);
+        }
+
+        // the churn threads fill one buffer per client, which a reduce
+        // pool could still be reading
+        if( gtp.churn && (gtp.shuffle || (gtp.reduce_threads > 0) || (launcherParams.rate_mbps > 0)) )
+        {
+            fprintf(stderr, "-churn cannot be combined with -sh, -rdp or -lq\n");
+            exit(-1);
+        }
+
+        // credit fan-ins wait on an overlapped receive, not a busy poll
+        if( (gtp.credit_window > 0) &&
+            (gtp.shuffle || gtp.churn || (gtp.background > 0) || !ccState.compare.empty() ||
+             (gtp.busy_poll_usec > 0)) )
+        {
+            fprintf(stderr, "-cw cannot be combined with -sh, -churn, -bg, -cmp or -bp\n");
+            exit(-1);
+        }
+
+        if( (gtp.stagger_tune || (gtp.stagger != STAGGER_NONE)) &&
+            ((gtp.credit_window > 0) || (gtp.background > 0) || !ccState.compare.empty()) )
+        {
+            fprintf(stderr, "-fb, -fw and -ft cannot be combined with -cw, -bg or -cmp\n");
+            exit(-1);
+        }
+
+        // a shuffling client needs every peer's fan-out before it answers
+        if( gtp.shuffle && (gtp.stagger_tune || (gtp.stagger == STAGGER_WINDOW)) )
+        {
+            fprintf(stderr, "-fw and -ft cannot be combined with -sh\n");
+            exit(-1);
+        }
+
+        // the stripe port is the server's, which a relay doesn't forward
+        if( (gtp.stripes > 1) &&
+            (gtp.shuffle || gtp.churn || (gtp.credit_window > 0) || (launcherParams.rate_mbps > 0)) )
+        {
+            fprintf(stderr, "-st cannot be combined with -sh, -churn, -cw or -lq\n");
+            exit(-1);
+        }
+
+        if( gtp.stripes > gtp.fi_msg_size )
+        {
+            fprintf(stderr, "-st cannot be more than the -i bytes to stripe\n");
+            exit(-1);
+        }
+
+        if( (gtp.collapse_line_mbps > 0) &&
+            (gtp.shuffle || (gtp.credit_window > 0) || gtp.stagger_tune || (gtp.stagger != STAGGER_NONE) ||
+             (gtp.background > 0) || !ccState.compare.empty()) )
+        {
+            fprintf(stderr, "-xc and -xi cannot be combined with -sh, -cw, -fb, -fw, -ft, -bg or -cmp\n");
+            exit(-1);
+        }
+
+        if( (gtp.collapse_max_size > 0) && (gtp.collapse_max_size <= gtp.fi_msg_size) )
+        {
+            fprintf(stderr, "-xi maximum must be larger than -i\n");
+            exit(-1);
+        }
+
+        if( gtp.stagger_tune && (gtp.stagger != STAGGER_NONE) )
+        {
+            fprintf(stderr, "-ft cannot be combined with -fb or -fw\n");
+            exit(-1);
+        }
+
+        // a grant is a single byte, which Nagle would sit on
+        if( gtp.credit_window > 0 )
+        {
+            gtp.nagle = false;
+        }
+
+        if( (gtp.reduce_threads > 0) && (gtp.reduce_op == REDUCE_NONE) )
+        {
+            fprintf(stderr, "-rdp needs -rd\n");
+            exit(-1);
+        }
+
+        if( (gtp.background > 0) && (gtp.shuffle || !ccState.compare.empty()) )
+        {
+            fprintf(stderr, "-bg cannot be combined with -sh or -cmp\n");
+            exit(-1);
+        }
+
+        if( simParams.clients > 0 )
+        {
+            if( gtp.shuffle || gtp.stack_timing || (gtp.warmup_cap > 0) ||
+                (gtp.converge_percentile > 0) || (gtp.background > 0) ||
+                (gtp.service_model != SERVICE_NONE) || (gtp.reduce_op != REDUCE_NONE) || gtp.churn ||
+                (gtp.credit_window > 0) || gtp.stagger_tune || (gtp.stagger != STAGGER_NONE) ||
+                (gtp.collapse_line_mbps > 0) || (gtp.stripes > 1) || gtp.host_counters ||
+                !ccState.mix.empty() || !ccState.compare.empty() )
+            {
+                fprintf(stderr, "-sim cannot be combined with -sh, -ts, -w, -cs, -bg, -svc, -rd, -churn, -cw, -fb, -fw, -ft, "
+                    "-xc, -xi, -st, -pc, -cc or -cmp\n");
+                exit(-1);
+            }
+
+            simulateMain();
+        }
+        else
+        {
+            if( launcherParams.clients > 0 )
+            {
+                // clients on one host would fight over its one setting
+                if( !ccState.mix.empty() || !ccState.compare.empty() )
+                {
+                    fprintf(stderr, "-local cannot be combined with -cc or -cmp\n");
+                    exit(-1);
+                }
+
+                gtp.clients_limited = true;
+                gtp.client_limit = launcherParams.clients;
+            }
+
+            serverMain();
+        }
     }
 
 #ifndef _M_ARM
@@ -958,4 +2492,6 @@ int __cdecl main( int argc, char** argv )
 #endif
 
     WSACleanup();
+
+    return releaseSkew.rejected ? 2 : 0;
 }
@@ -32,6 +32,7 @@
 #define NOMINMAX
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
 #include <windows.h>
 #include <iphlpapi.h>
 #include <process.h>
@@ -56,6 +57,10 @@ const int DEFAULT_ITERS = 10000;
 const int WARMUP_ITERS = 10;
 const int DEFAULT_FO_MSG_SIZE = 256;
 const int DEFAULT_FI_MSG_SIZE = 4096;
+const int CREDIT_DEFAULT_CHUNK = 8192;
+const double COLLAPSE_DEFAULT_FRACTION = 0.5;
+const int SHUFFLE_DONE_MSG_SIZE = 1;
+const int RECONNECT_TIMEOUT_MSEC = 60000;
 
 enum DelayMethod
 {
@@ -64,6 +69,32 @@ enum DelayMethod
         UNIFORM_SCHED
 };
 
+// client work before each fan-in, see service.h
+enum ServiceModel
+{
+    SERVICE_NONE,
+    SERVICE_FIXED,
+    SERVICE_EXPONENTIAL,
+    SERVICE_HASH
+};
+
+// server work on each fan-in, see reduce.h
+enum ReduceOp
+{
+    REDUCE_NONE,
+    REDUCE_SUM,
+    REDUCE_MINMAX,
+    REDUCE_TOPK_MERGE
+};
+
+// fan-out scheduling, see stagger.h
+enum StaggerPolicy
+{
+    STAGGER_NONE,
+    STAGGER_BATCH,
+    STAGGER_WINDOW
+};
+
 struct GlobalTestParameters
 {
     int clients;
@@ -86,6 +117,77 @@ struct GlobalTestParameters
 
     bool histogram;
 
+    // all-to-all shuffle: every client also sends a
+    // fi_msg_size partition to every other client
+    bool shuffle;
+
+    // thread placement specs, see placement.h
+    char placement[64];
+    char client_placement[64];
+
+    // spin this long for a message before blocking in recv (0 = never)
+    int busy_poll_usec;
+
+    // fill payloads with a checked pattern, see payload.h
+    bool verify;
+
+    // sample the stack's RTT estimate after every volley
+    bool stack_timing;
+
+    // adaptive warm-up of at most this many volleys, see warmup.h;
+    // 0 for the fixed WARMUP_ITERS
+    int warmup_cap;
+
+    // report percentile confidence intervals, and stop once the
+    // converge_percentile interval is within converge_width (relative)
+    // of it, see confidence.h; 0 to always run iters volleys
+    bool confidence;
+    int converge_percentile;
+    double converge_width;
+
+    // the last background clients stream toward the server instead of
+    // volleying, at background_mbps each (0 = no cap), see background.h
+    int background;
+    int background_mbps;
+    bool background_on;     // this run streams; the other one idles
+
+    ServiceModel service_model;
+    int service_param;      // usec, or bytes to hash
+
+    ReduceOp reduce_op;
+    int reduce_threads;     // 0 to reduce inline in the serverThreads
+
+    // a new connection for every fan-in, see churn.h
+    bool churn;
+    int churn_backlog;
+
+    // receiver-driven fan-in: at most credit_window bytes granted across
+    // the clients, in credit_chunk pieces, see credit.h
+    int credit_window;
+    int credit_chunk;
+    bool credit_srf;        // shortest remaining first, else round robin
+    bool credit_on;         // this run uses credits; the other is plain
+
+    // fan-outs in batches of stagger_size every stagger_gap_usec, or to
+    // at most stagger_size answering clients at a time
+    StaggerPolicy stagger;
+    int stagger_size;
+    int stagger_gap_usec;
+    bool stagger_tune;
+
+    // search for incast collapse over the clients, or over the fan-in
+    // size up to collapse_max_size, see collapse.h
+    int collapse_line_mbps;
+    int collapse_max_size;
+    double collapse_fraction;
+
+    // connections each client splits its fan-in across, see stripe.h
+    int stripes;
+
+    // cycles, context switches and the like around the measured phase,
+    // see counters.h
+    bool host_counters;
+
     GlobalTestParameters()
         : clients(0)
         , iters(DEFAULT_ITERS)
@@ -101,24 +203,143 @@ struct GlobalTestParameters
         , send_buffer(-1)
         , recv_buffer(-1)
         , histogram(false)
-    {};
+        , shuffle(false)
+        , busy_poll_usec(0)
+        , verify(false)
+        , stack_timing(false)
+        , warmup_cap(0)
+        , confidence(false)
+        , converge_percentile(0)
+        , converge_width(0)
+        , background(0)
+        , background_mbps(0)
+        , background_on(false)
+        , service_model(SERVICE_NONE)
+        , service_param(0)
+        , reduce_op(REDUCE_NONE)
+        , reduce_threads(0)
+        , churn(false)
+        , churn_backlog(0)
+        , credit_window(0)
+        , credit_chunk(CREDIT_DEFAULT_CHUNK)
+        , credit_srf(false)
+        , credit_on(false)
+        , stagger(STAGGER_NONE)
+        , stagger_size(0)
+        , stagger_gap_usec(0)
+        , stagger_tune(false)
+        , collapse_line_mbps(0)
+        , collapse_max_size(0)
+        , collapse_fraction(COLLAPSE_DEFAULT_FRACTION)
+        , stripes(1)
+        , host_counters(false)
+    {
+        placement[0] = 0;
+        client_placement[0] = 0;
+    };
 } gtp;
 
+// the clients taking part in the volleys
+int incastClients()
+{
+    return gtp.clients - gtp.background;
+}
+
 struct ClientSpecificTestParameters
 {
     int client_num;
+    char congestion[16];    // algorithm name, see congestion.h
+    bool congestion_set;    // -cc or -cmp is in effect
+
     ClientSpecificTestParameters()
         : client_num(-1)
+        , congestion_set(false)
+    {
+        strcpy_s( congestion, sizeof(congestion), "default" );
+    };
+};
+
+struct Placement
+{
+    bool pinned;
+    int group;
+    int cpu;    // -1 when pinned to a whole NUMA node
+    int node;
+
+    Placement()
+        : pinned(false)
+        , group(-1)
+        , cpu(-1)
+        , node(-1)
+    {};
+};
+
+// process CPU time and wall clock time, in usec
+struct CpuTimes
+{
+    __int64 user;
+    __int64 kernel;
+    __int64 wall;
+
+    CpuTimes()
+        : user(0)
+        , kernel(0)
+        , wall(0)
+    {};
+};
+
+// the cost of the measured phase to a volley thread and its host, see
+// counters.h
+struct HostCounters
+{
+    bool system;                // context switches and host times were read
+    DWORD thread_id;
+    ULONG64 cycles;
+    __int64 context_switches;
+    int migrations;             // processor changes seen between volleys
+    int cpu;                    // the last processor seen
+    __int64 dpc_usec;           // whole host
+    __int64 interrupt_usec;
+
+    HostCounters()
+        : system(false)
+        , thread_id(0)
+        , cycles(0)
+        , context_switches(0)
+        , migrations(0)
+        , cpu(-1)
+        , dpc_usec(0)
+        , interrupt_usec(0)
     {};
 };
 
 struct ClientResultData
 {
     int retransmits;
+    Placement placement;
+    CpuTimes cpu;   // spent in the measured phase
+    HostCounters counters;
+
+    int mismatches;         // fan-outs that failed verification
+    __int64 verify_usec;
+
+    // clients on the same host share the system-wide counters, however
+    // many addresses the host has
+    char host[64];
 
     ClientResultData()
         : retransmits(0)
-    {};
+        , mismatches(0)
+        , verify_usec(0)
+    {
+        host[0] = 0;
+    };
+};
+
+struct PayloadHeader
+{
+    int client_num;
+    int iter;
 };
 
 struct Measurement
@@ -126,6 +347,7 @@ struct Measurement
     __int64 actual_delay;
     __int64 start;
     __int64 stop;
+    __int64 release;    // when the barrier released the serverThreads, after onRelease
 };
 
 typedef std::vector<Measurement> Measurements;
@@ -134,19 +356,87 @@ struct TestResult
 {
     ClientResultData crd;
     Measurements measurements;
+    Placement placement;     // of the serverThread
+    HostCounters counters;   // of the serverThread
+
+    int mismatches;         // fan-ins that failed verification
+    __int64 verify_ticks;
+
+    std::vector<int> stack_rtt_usec;    // one per volley, see SIO_TCP_INFO
+    int min_rtt_usec;
+    int mss;
+
+    char congestion_status;
+
+    std::vector<int> service_usec;      // one per volley, from the client
+
+    std::vector<int> churn_connect_usec;    // one per volley, from the client
+    int churn_retries;
+
+    std::vector<__int64> stripe_spread;     // first to last stripe, per volley
+    std::vector<int> stripe_last;           // per stripe, volleys it was last
+
+    TestResult()
+        : mismatches(0)
+        , verify_ticks(0)
+        , min_rtt_usec(-1)
+        , mss(0)
+        , congestion_status(0)
+        , churn_retries(0)
+    {};
+};
+
+// the headline numbers of one run, for comparing runs
+struct TestSummary
+{
+    double median_usec;
+    double p99_usec;
+    double max_usec;
+    double recv_mbps;
+    double iters_per_sec;
+    int retransmits;
 };
 
 std::vector<TestResult> clientResults;
 std::vector<HANDLE> clientThreads;
 std::vector<SOCKET> clientSockets;
+std::vector<SOCKADDR_INET> clientAddresses;
+std::vector<std::string> clientInterfaces;  // the server's, see interfaces.h
 
-barrier *pb;
+// the server listens on, and clients connect to, one of
+// basePort .. basePort+listenPorts-1
+unsigned basePort = PORT;
+int listenPorts = 1;
+int acceptThreadsPerPort = 1;
+
+// the server listens on these addresses, or on every IPv4 address
+std::vector<SOCKADDR_INET> bindAddresses;
+
+// clients connect from this address, or AF_UNSPEC to leave it to the
+// stack, see launcher.h and interfaces.h
+SOCKADDR_INET localAddress;
+
+struct AcceptState
+{
+    std::vector<SOCKET> listenSockets;
+    std::vector<HANDLE> threads;
+
+    // protects the client registration vectors and gtp.clients
+    CRITICAL_SECTION lock;
+    HANDLE limitReached;
+    bool stopping;
+
+    __int64 listenStart;
+    __int64 firstConnect;
+    __int64 lastConnect;
+} acceptState;
+
+barrier *pb;     // the volleying serverThreads
+barrier *pab;    // all serverThreads
 
 std::ofstream histfile;
     
 MIB_TCPSTATS tcpStatsBefore, tcpStatsAfter;
-
-typedef std::map<std::string,std::vector<int>> ClientAddressMap;
-ClientAddressMap clientAddressMap;
+CpuTimes cpuBefore, cpuAfter;
 
 #endif // _INCAST_H
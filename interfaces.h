@@ -0,0 +1,261 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_INTERFACES_H
+#define _INCAST_INTERFACES_H
+
+// Multi-homed hosts.  The server can listen on a list of local addresses
+// with -bind, one listener per address and port, to spread a test over
+// several NICs or to keep it on one; a client picks its source with -la,
+// by address or by interface name or index.  Either can be IPv6.
+//
+// Each connection is put down to the server interface it arrived on,
+// so the report can break the results down by NIC rather than by the
+// clients' addresses.
+
+// the adapters with their addresses; NULL on failure, else free() it
+PIP_ADAPTER_ADDRESSES getAdapters()
+{
+    ULONG size = 16 * 1024;
+
+    for( int attempt = 0; attempt < 3; ++attempt )
+    {
+        PIP_ADAPTER_ADDRESSES adapters = (PIP_ADAPTER_ADDRESSES) malloc( size );
+
+        ULONG r = GetAdaptersAddresses( AF_UNSPEC,
+            GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER,
+            NULL, adapters, &size );
+
+        if( r == NO_ERROR )
+            return adapters;
+
+        free( adapters );
+
+        if( r != ERROR_BUFFER_OVERFLOW )
+            break;
+    }
+
+    return NULL;
+}
+
+std::string adapterName( PIP_ADAPTER_ADDRESSES a )
+{
+    char name[256];
+    if( WideCharToMultiByte( CP_ACP, 0, a->FriendlyName, -1, name, sizeof(name), NULL, NULL ) == 0 )
+        return a->AdapterName;
+
+    return name;
+}
+
+bool sameAddress( const SOCKADDR_INET &a, const SOCKADDR *b )
+{
+    if( a.si_family != b->sa_family )
+        return false;
+
+    if( a.si_family == AF_INET )
+        return memcmp( &a.Ipv4.sin_addr, &((const SOCKADDR_IN *) b)->sin_addr, sizeof(IN_ADDR) ) == 0;
+
+    return memcmp( &a.Ipv6.sin6_addr, &((const SOCKADDR_IN6 *) b)->sin6_addr, sizeof(IN6_ADDR) ) == 0;
+}
+
+// the first address of an interface, by name or index, IPv4 if it has one
+bool resolveInterface( const char *name, SOCKADDR_INET &addr )
+{
+    PIP_ADAPTER_ADDRESSES adapters = getAdapters();
+    if( adapters == NULL )
+        return false;
+
+    const ULONG index = (ULONG) atoi( name );
+    bool found = false;
+
+    for( PIP_ADAPTER_ADDRESSES a = adapters; a && !found; a = a->Next )
+    {
+        if( (_stricmp( adapterName( a ).c_str(), name ) != 0) && (a->IfIndex != index) )
+            continue;
+
+        for( ADDRESS_FAMILY family : { AF_INET, AF_INET6 } )
+        {
+            for( PIP_ADAPTER_UNICAST_ADDRESS u = a->FirstUnicastAddress; u && !found; u = u->Next )
+            {
+                if( u->Address.lpSockaddr->sa_family == family )
+                {
+                    memset( &addr, 0, sizeof(addr) );
+                    memcpy( &addr, u->Address.lpSockaddr, u->Address.iSockaddrLength );
+                    found = true;
+                }
+            }
+        }
+    }
+
+    free( adapters );
+    return found;
+}
+
+// an address, or the name of an interface
+bool parseSourceAddress( const char *s, SOCKADDR_INET &addr )
+{
+    return parseAddress( s, addr ) || resolveInterface( s, addr );
+}
+
+// comma-separated addresses
+bool parseBindAddresses( const char *spec, std::vector<SOCKADDR_INET> &addrs )
+{
+    addrs.clear();
+
+    std::stringstream ss( spec );
+    std::string item;
+
+    while( std::getline( ss, item, ',' ) )
+    {
+        SOCKADDR_INET a;
+        if( !parseSourceAddress( item.c_str(), a ) )
+            return false;
+
+        addrs.push_back( a );
+    }
+
+    return !addrs.empty();
+}
+
+// every local address with its interface's name, taken once per
+// acceptClients so the accept threads don't each walk the adapters
+std::vector<std::pair<SOCKADDR_INET, std::string>> interfaceTable;
+
+void loadInterfaceTable()
+{
+    interfaceTable.clear();
+
+    PIP_ADAPTER_ADDRESSES adapters = getAdapters();
+    if( adapters == NULL )
+        return;
+
+    for( PIP_ADAPTER_ADDRESSES a = adapters; a; a = a->Next )
+    {
+        for( PIP_ADAPTER_UNICAST_ADDRESS u = a->FirstUnicastAddress; u; u = u->Next )
+        {
+            SOCKADDR_INET addr = {0};
+            memcpy( &addr, u->Address.lpSockaddr, u->Address.iSockaddrLength );
+            interfaceTable.push_back( std::make_pair( addr, adapterName( a ) ) );
+        }
+    }
+
+    free( adapters );
+}
+
+// the name of the interface a local address belongs to
+std::string interfaceOf( const SOCKADDR_INET &local )
+{
+    std::string name = addressString( local );
+
+    for( auto &entry : interfaceTable )
+    {
+        if( sameAddress( local, (const SOCKADDR *) &entry.first ) )
+            return entry.second + " " + name;
+    }
+
+    return name;
+}
+
+// the test's other listeners, for churn and stripes, take whichever
+// family the clients connect with
+SOCKET createAuxListener( unsigned port, int backlog = 65535 )
+{
+    for( auto &a : bindAddresses )
+    {
+        if( a.si_family == AF_INET6 )
+        {
+            SOCKADDR_INET any = {0};
+            any.si_family = AF_INET6;
+            return createListener( port, backlog, &any, true );
+        }
+    }
+
+    return createListener( port, backlog );
+}
+
+std::string bindDescription()
+{
+    std::string s;
+    for( auto &a : bindAddresses )
+    {
+        s += (s.empty() ? "" : ", ") + addressString( a );
+    }
+
+    return s;
+}
+
+// volley latency of each client, grouped by the server interface its
+// connection came in on
+void reportInterfaces()
+{
+    if( clientInterfaces.size() < clientResults.size() )
+        return;
+
+    std::map<std::string, std::vector<int>> groups;
+    for( unsigned c = 0; c < clientResults.size(); ++c )
+    {
+        groups[clientInterfaces[c]].push_back( c );
+    }
+
+    if( (groups.size() < 2) && bindAddresses.empty() )
+        return;
+
+    printf( "\nBy server interface:\n" );
+    printf( "\t%-36s %8s %12s %12s %12s\n", "interface", "clients", "median usec", "99th usec", "mbit/s recv" );
+
+    for( auto &g : groups )
+    {
+        std::vector<__int64> latency;
+        __int64 first = std::numeric_limits<__int64>::max();
+        __int64 last = std::numeric_limits<__int64>::min();
+
+        for( int c : g.second )
+        {
+            for( auto &m : clientResults[c].measurements )
+            {
+                latency.push_back( m.stop - m.start );
+                first = std::min( first, m.start );
+                last = std::max( last, m.stop );
+            }
+        }
+
+        if( latency.empty() )
+            continue;
+
+        std::sort( latency.begin(), latency.end() );
+        const size_t n = latency.size();
+
+        const double seconds = ((double) (last - first)) / freq;
+
+        printf( "\t%-36s %8u %12.3f %12.3f %12.3f\n",
+            g.first.c_str(), (unsigned) g.second.size(),
+            latency[n / 2] * 1.0e6 / freq,
+            latency[std::min( n - 1, n * 99 / 100 )] * 1.0e6 / freq,
+            gtp.fi_msg_size * 8.0 * n / seconds / 1.0e6 );
+    }
+}
+
+#endif // _INCAST_INTERFACES_H
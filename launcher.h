@@ -0,0 +1,149 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_LAUNCHER_H
+#define _INCAST_LAUNCHER_H
+
+// Local launcher.  Runs the clients, and optionally a bottleneck relay in
+// front of the server, as child processes on the server's own host, so a
+// test needs one machine.
+//
+// Each client connects from its own loopback address, 127.0.0.2 and up.
+// The server groups and reports them by address as it would separate
+// hosts, and every client still goes through the real TCP stack.  The
+// relay connects to the server from the address of the client it
+// forwards for, so that survives the bottleneck too.
+//
+// The children belong to a job object that kills them when the server
+// exits, however it exits.
+
+struct LauncherParameters
+{
+    int clients;            // 0 when not launching
+    double rate_mbps;       // relay egress rate, 0 for no relay
+    int buffer;             // relay egress queue limit, bytes
+
+    LauncherParameters()
+        : clients(0)
+        , rate_mbps(0)
+        , buffer(relayParams.buffer)
+    {};
+} launcherParams;
+
+in_addr launcherClientAddress( int k )
+{
+    in_addr a;
+    a.s_addr = htonl( INADDR_LOOPBACK + 1 + k );
+    return a;
+}
+
+class LocalLauncher
+{
+public:
+
+    LocalLauncher()
+        : job_(NULL)
+    {}
+
+    // call once the server is listening
+    void start()
+    {
+        if( (job_ = CreateJobObject( NULL, NULL )) == NULL )
+        {
+            fprintf(stderr, "CreateJobObject() failed: %d\n", GetLastError());
+            exit(-1);
+        }
+
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION info = {0};
+        info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        SetInformationJobObject( job_, JobObjectExtendedLimitInformation, &info, sizeof(info) );
+
+        GetModuleFileNameA( NULL, exe_, sizeof(exe_) );
+
+        char args[256];
+        unsigned port = basePort;
+
+        if( launcherParams.rate_mbps > 0 )
+        {
+            sprintf_s( args, sizeof(args), "-relay 127.0.0.1 -p %u -lp %d -rp %u -q %f -qb %d",
+                basePort, listenPorts, relayParams.port, launcherParams.rate_mbps, launcherParams.buffer );
+            spawn( args );
+
+            port = relayParams.port;
+        }
+
+        for( int k = 0; k < launcherParams.clients; ++k )
+        {
+            sprintf_s( args, sizeof(args), "127.0.0.1 -p %u -lp %d -la %s",
+                port, listenPorts, inet_ntoa( launcherClientAddress( k ) ) );
+            spawn( args );
+        }
+
+        printf( "Launched %d local clients%s.\n", launcherParams.clients,
+            (launcherParams.rate_mbps > 0) ? " behind a relay" : "" );
+    }
+
+    // kills the children
+    ~LocalLauncher()
+    {
+        if( job_ != NULL )
+        {
+            CloseHandle( job_ );
+        }
+    }
+
+private:
+
+    HANDLE job_;
+    char exe_[MAX_PATH];
+
+    // without a console, so the clients' progress doesn't mix with ours
+    void spawn( const char *args )
+    {
+        std::string cmd = std::string( "\"" ) + exe_ + "\" " + args;
+        std::vector<char> line( cmd.begin(), cmd.end() );
+        line.push_back( 0 );
+
+        STARTUPINFOA si = { sizeof(si) };
+        PROCESS_INFORMATION pi;
+
+        // suspended until it is in the job, so it can't outlive us
+        if( !CreateProcessA( NULL, line.data(), NULL, NULL, FALSE,
+                CREATE_SUSPENDED | CREATE_NO_WINDOW, NULL, NULL, &si, &pi ) )
+        {
+            fprintf(stderr, "CreateProcess() failed: %d\n", GetLastError());
+            exit(-1);
+        }
+
+        AssignProcessToJobObject( job_, pi.hProcess );
+        ResumeThread( pi.hThread );
+
+        CloseHandle( pi.hThread );
+        CloseHandle( pi.hProcess );
+    }
+} localLauncher;
+
+#endif // _INCAST_LAUNCHER_H
@@ -1 +1,3 @@
-cl /EHsc /O2 incast.cpp ws2_32.lib iphlpapi.lib winmm.lib
+cl /EHsc /O2 incast.cpp ws2_32.lib iphlpapi.lib winmm.lib ntdll.lib
+if "%1"=="bench" cl /EHsc /O2 bench.cpp ws2_32.lib iphlpapi.lib winmm.lib
+if "%1"=="analyze" cl /EHsc /O2 analyze.cpp ws2_32.lib iphlpapi.lib winmm.lib
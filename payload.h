@@ -0,0 +1,235 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_PAYLOAD_H
+#define _INCAST_PAYLOAD_H
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+    #include <intrin.h>
+    #include <nmmintrin.h>
+#endif
+
+// Payload integrity.  A verified payload is laid out as
+//
+//     PayloadHeader | pseudo-random pattern | CRC32C of everything before
+//
+// The pattern is seeded from the client number and iteration, so a
+// payload delivered to the wrong client or volley fails too.
+
+const int PAYLOAD_TRAILER_SIZE = sizeof(unsigned);
+const int MIN_VERIFIED_MSG_SIZE = sizeof(PayloadHeader) + PAYLOAD_TRAILER_SIZE;
+
+unsigned crc32cTable[256];
+
+bool initCrc32cTable()
+{
+    // Castagnoli polynomial, reflected
+    const unsigned POLY = 0x82F63B78;
+
+    for( unsigned i = 0; i < 256; ++i )
+    {
+        unsigned crc = i;
+        for( int b = 0; b < 8; ++b )
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ POLY : (crc >> 1);
+        }
+        crc32cTable[i] = crc;
+    }
+
+    return true;
+}
+
+static bool crc32cTableReady = initCrc32cTable();
+
+unsigned crc32cSoftware( unsigned crc, const unsigned char *p, size_t len )
+{
+    while( len-- )
+    {
+        crc = crc32cTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+bool hasSse42()
+{
+    int info[4];
+    __cpuid( info, 1 );
+    return (info[2] & (1 << 20)) != 0;
+}
+
+static bool crc32cHardware = hasSse42();
+
+unsigned crc32cSse42( unsigned crc, const unsigned char *p, size_t len )
+{
+#ifdef _M_X64
+    unsigned __int64 crc64 = crc;
+    while( len >= 8 )
+    {
+        unsigned __int64 v;
+        memcpy( &v, p, 8 );
+        crc64 = _mm_crc32_u64( crc64, v );
+        p += 8;
+        len -= 8;
+    }
+    crc = (unsigned) crc64;
+#endif
+
+    while( len >= 4 )
+    {
+        unsigned v;
+        memcpy( &v, p, 4 );
+        crc = _mm_crc32_u32( crc, v );
+        p += 4;
+        len -= 4;
+    }
+
+    while( len-- )
+    {
+        crc = _mm_crc32_u8( crc, *p++ );
+    }
+
+    return crc;
+}
+#else
+static bool crc32cHardware = false;
+#endif
+
+unsigned crc32c( const void *data, size_t len )
+{
+    const unsigned char *p = (const unsigned char *) data;
+
+#if defined(_M_X64) || defined(_M_IX86)
+    if( crc32cHardware )
+        return ~crc32cSse42( ~0u, p, len );
+#endif
+
+    return ~crc32cSoftware( ~0u, p, len );
+}
+
+void fillPayload( char *buf, int size, int client_num, int iter )
+{
+    PayloadHeader h;
+    h.client_num = client_num;
+    h.iter = iter;
+    memcpy( buf, &h, sizeof(h) );
+
+    // xorshift64, never seeded with zero
+    unsigned __int64 x =
+        ((unsigned __int64) (client_num + 1) << 32) ^ (unsigned) iter ^ 0x9E3779B97F4A7C15ull;
+
+    const int end = size - PAYLOAD_TRAILER_SIZE;
+    for( int i = sizeof(h); i < end; i += 8 )
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy( buf + i, &x, std::min( 8, end - i ) );
+    }
+
+    unsigned crc = crc32c( buf, end );
+    memcpy( buf + end, &crc, sizeof(crc) );
+}
+
+bool verifyPayload( const char *buf, int size, int client_num, int iter )
+{
+    PayloadHeader h;
+    memcpy( &h, buf, sizeof(h) );
+
+    if( (h.client_num != client_num) || (h.iter != iter) )
+        return false;
+
+    const int end = size - PAYLOAD_TRAILER_SIZE;
+
+    unsigned crc;
+    memcpy( &crc, buf + end, sizeof(crc) );
+
+    return crc == crc32c( buf, end );
+}
+
+// client side, once a volley has been answered: check its fan-out and
+// prepare the next fan-in, off the latency-critical path
+void clientCheckPayloads( ClientResultData &crd, const char *fobuf, char *fibuf,
+    int client_num, int iter, int next_iter )
+{
+    __int64 start = qpc();
+
+    if( !verifyPayload( fobuf, gtp.fo_msg_size, client_num, iter ) )
+    {
+        crd.mismatches++;
+    }
+
+    fillPayload( fibuf, gtp.fi_msg_size, client_num, next_iter );
+
+    crd.verify_usec += (__int64) (qpc_to_msec( qpc() - start ) * 1000);
+}
+
+void reportIntegrity()
+{
+    if( !gtp.verify )
+        return;
+
+    const int clients = clientResults.size();
+
+    int faninMismatches = 0;
+    int fanoutMismatches = 0;
+    __int64 serverTicks = 0;
+    __int64 clientUsec = 0;
+
+    for( int c = 0; c < clients; ++c )
+    {
+        faninMismatches += clientResults[c].mismatches;
+        fanoutMismatches += clientResults[c].crd.mismatches;
+        serverTicks += clientResults[c].verify_ticks;
+        clientUsec += clientResults[c].crd.verify_usec;
+    }
+
+    printf( "\nPayload integrity (CRC32C, %s):\n", crc32cHardware ? "SSE4.2" : "software" );
+    printf( "\tfan-in mismatches:    %10d\n", faninMismatches );
+    printf( "\tfan-out mismatches:   %10d\n", fanoutMismatches );
+
+    // kept out of the latency measurements, which stay comparable
+    // with unverified runs
+    printf( "\tserver usec/iter:     %10.3f\n", serverTicks * 1.0e6 / freq / gtp.iters );
+    printf( "\tclient usec/iter avg: %10.3f\n", ((double) clientUsec) / clients / gtp.iters );
+
+    for( int c = 0; c < clients; ++c )
+    {
+        if( clientResults[c].mismatches || clientResults[c].crd.mismatches )
+        {
+            printf( "\tclient %3d from %15s: %d fan-in, %d fan-out\n",
+                c,
+                addressString( clientAddresses[c] ).c_str(),
+                clientResults[c].mismatches,
+                clientResults[c].crd.mismatches );
+        }
+    }
+}
+
+#endif // _INCAST_PAYLOAD_H
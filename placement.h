@@ -0,0 +1,298 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_PLACEMENT_H
+#define _INCAST_PLACEMENT_H
+
+// Thread placement.  A placement spec is one of:
+//
+//     (empty)   no pinning, the scheduler decides
+//     numa      spread threads round-robin across NUMA nodes
+//     rss       pin each thread to the processor that receives its
+//               socket's traffic (SIO_QUERY_RSS_PROCESSOR_INFO)
+//     LIST      pin threads round-robin to a core list such as 0-7,16
+//
+// Cores are numbered across processor groups, group 0 first.
+
+bool isNumaPlacement( const char *spec )
+{
+    return strcmp( spec, "numa" ) == 0;
+}
+
+bool isRssPlacement( const char *spec )
+{
+    return strcmp( spec, "rss" ) == 0;
+}
+
+std::vector<PROCESSOR_NUMBER> getProcessors()
+{
+    std::vector<PROCESSOR_NUMBER> procs;
+
+    WORD groups = GetActiveProcessorGroupCount();
+    for( WORD g = 0; g < groups; ++g )
+    {
+        DWORD count = GetActiveProcessorCount( g );
+        for( DWORD n = 0; n < count; ++n )
+        {
+            PROCESSOR_NUMBER pn = {0};
+            pn.Group = g;
+            pn.Number = (BYTE) n;
+            procs.push_back( pn );
+        }
+    }
+
+    return procs;
+}
+
+// returns false if the list is malformed or names a core we don't have
+bool parseCoreList( const char *spec, std::vector<int> &cores )
+{
+    const int available = getProcessors().size();
+
+    cores.clear();
+
+    const char *p = spec;
+    while( *p )
+    {
+        char *end;
+        long first = strtol( p, &end, 10 );
+        if( end == p )
+            return false;
+
+        long last = first;
+        p = end;
+
+        if( *p == '-' )
+        {
+            ++p;
+            last = strtol( p, &end, 10 );
+            if( end == p )
+                return false;
+            p = end;
+        }
+
+        if( first < 0 || last < first || last >= available )
+            return false;
+
+        for( long c = first; c <= last; ++c )
+            cores.push_back( c );
+
+        if( *p == ',' )
+            ++p;
+        else if( *p )
+            return false;
+    }
+
+    return !cores.empty();
+}
+
+bool isValidPlacement( const char *spec )
+{
+    std::vector<int> cores;
+
+    return (*spec == 0) ||
+        isNumaPlacement( spec ) ||
+        isRssPlacement( spec ) ||
+        parseCoreList( spec, cores );
+}
+
+// undo a previous test's pinning
+void unpinThread()
+{
+    DWORD_PTR processMask, systemMask;
+    GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask );
+    SetThreadAffinityMask( GetCurrentThread(), processMask );
+}
+
+void pinToProcessor( const PROCESSOR_NUMBER &pn )
+{
+    GROUP_AFFINITY ga = {0};
+    ga.Group = pn.Group;
+    ga.Mask = ((KAFFINITY) 1) << pn.Number;
+
+    if( !SetThreadGroupAffinity( GetCurrentThread(), &ga, NULL ) )
+    {
+        fprintf(stderr, "SetThreadGroupAffinity() failed: %d\n", GetLastError());
+    }
+}
+
+// pin the calling thread, the index-th of its kind, according to spec;
+// s is the socket the thread serves
+void applyPlacement( const char *spec, int index, SOCKET s, Placement &placed )
+{
+    if( *spec == 0 )
+        return;
+
+    if( isNumaPlacement( spec ) )
+    {
+        ULONG highest = 0;
+        GetNumaHighestNodeNumber( &highest );
+
+        GROUP_AFFINITY ga = {0};
+        USHORT node = (USHORT) (index % (highest + 1));
+
+        if( !GetNumaNodeProcessorMaskEx( node, &ga ) ||
+            !SetThreadGroupAffinity( GetCurrentThread(), &ga, NULL ) )
+        {
+            fprintf(stderr, "pinning to NUMA node %u failed: %d\n", node, GetLastError());
+            return;
+        }
+
+        // free to move between the node's cores
+        placed.pinned = true;
+        placed.group = ga.Group;
+        placed.cpu = -1;
+        placed.node = node;
+        return;
+    }
+    else if( isRssPlacement( spec ) )
+    {
+        SOCKET_PROCESSOR_AFFINITY spa;
+        DWORD bytes;
+
+        // fails on loopback and on NICs without RSS
+        if (WSAIoctl(s, SIO_QUERY_RSS_PROCESSOR_INFO, NULL, 0,
+                &spa, sizeof(spa), &bytes, NULL, NULL) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "SIO_QUERY_RSS_PROCESSOR_INFO failed: %d\n", WSAGetLastError());
+            return;
+        }
+
+        pinToProcessor( spa.ProcNum );
+    }
+    else
+    {
+        // the list was checked against the server's cores, not ours
+        std::vector<int> cores;
+        if( !parseCoreList( spec, cores ) )
+        {
+            fprintf(stderr, "core list %s not valid on this machine\n", spec);
+            return;
+        }
+
+        pinToProcessor( getProcessors()[ cores[index % cores.size()] ] );
+    }
+
+    // record where we actually ended up
+    PROCESSOR_NUMBER pn;
+    GetCurrentProcessorNumberEx( &pn );
+
+    USHORT node = 0;
+    GetNumaProcessorNodeEx( &pn, &node );
+
+    placed.pinned = true;
+    placed.group = pn.Group;
+    placed.cpu = pn.Number;
+    placed.node = node;
+}
+
+struct LocalBufferDeleter
+{
+    bool numa;
+
+    void operator()( char *p ) const
+    {
+        if( numa )
+            VirtualFree( p, 0, MEM_RELEASE );
+        else
+            delete[] p;
+    }
+};
+
+typedef std::unique_ptr<char[], LocalBufferDeleter> LocalBuffer;
+
+// allocate a message buffer on the NUMA node a pinned thread runs on
+LocalBuffer allocLocalBuffer( int size, const Placement &placed )
+{
+    if( !placed.pinned )
+    {
+        LocalBufferDeleter d = { false };
+        return LocalBuffer( new char[size], d );
+    }
+
+    char *p = (char*) VirtualAllocExNuma( GetCurrentProcess(), NULL, size,
+        MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, placed.node );
+
+    HARD_ASSERT( p != NULL );
+
+    LocalBufferDeleter d = { true };
+    return LocalBuffer( p, d );
+}
+
+void reportPlacement()
+{
+    using namespace std;
+
+    if( (gtp.placement[0] == 0) && (gtp.client_placement[0] == 0) )
+        return;
+
+    printf( "\nPlacement:\n" );
+    printf( "\tserver threads:       %s\n", gtp.placement[0] ? gtp.placement : "none" );
+    printf( "\tclient threads:       %s\n", gtp.client_placement[0] ? gtp.client_placement : "none" );
+
+    // which clients' threads ended up where, server side then client side
+    for( int side = 0; side < 2; ++side )
+    {
+        map<string,vector<int>> where;
+
+        for( unsigned c = 0; c < clientResults.size(); ++c )
+        {
+            const Placement &pl = (side == 0) ?
+                clientResults[c].placement : clientResults[c].crd.placement;
+
+            char buf[64];
+            if( pl.pinned && pl.cpu < 0 )
+                sprintf_s( buf, sizeof(buf), "node %d, any cpu", pl.node );
+            else if( pl.pinned )
+                sprintf_s( buf, sizeof(buf), "cpu %2d:%-3d node %d", pl.group, pl.cpu, pl.node );
+            else
+                sprintf_s( buf, sizeof(buf), "unpinned" );
+
+            string key( buf );
+
+            if( side == 1 )
+            {
+                key = addressString( clientAddresses[c] ) + " " + key;
+            }
+
+            where[key].push_back( c );
+        }
+
+        printf( side == 0 ? "\n\tserver thread for client:\n" : "\n\tclient thread:\n" );
+
+        for( auto i : where )
+        {
+            printf( "\t\t%-36s", i.first.c_str() );
+            for( auto c : i.second )
+            {
+                printf( " %d", c );
+            }
+            printf( "\n" );
+        }
+    }
+}
+
+#endif // _INCAST_PLACEMENT_H
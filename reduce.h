@@ -0,0 +1,466 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_REDUCE_H
+#define _INCAST_REDUCE_H
+
+#include <deque>
+
+#if defined(_M_X64) || defined(_M_IX86)
+    #include <xmmintrin.h>
+#endif
+
+// Reduce phase.  An aggregator doesn't just receive its fan-ins, it
+// combines them, and that work competes with receiving for the cache,
+// memory bandwidth and the time between reads.  With -rd each fan-in is
+// read as an array of floats and folded into a partial result with SSE:
+//
+//     sum        the sum of all values
+//     minmax     the smallest and largest value
+//     topk       the REDUCE_TOPK largest values; a compare against the
+//                current k-th picks the few candidates worth inserting
+//
+// The partials of a volley are merged by whichever fold finishes last,
+// which also timestamps the volley as reduced.
+//
+// Folds run inline in the serverThreads, after the fan-in is timed, or on
+// a pool of gtp.reduce_threads threads.  With a pool, each serverThread
+// alternates between two fan-in buffers so a volley's fold overlaps the
+// next volley's exchange.  Before reusing a buffer it waits for its own
+// fold of two volleys back, and then for that volley to be merged, since
+// with several workers another client's fold may still hold the slot of
+// partials the next fold would write to.
+
+const int REDUCE_TOPK = 16;
+
+bool parseReduceOp( const char *name, ReduceOp &op )
+{
+    if( strcmp( name, "sum" ) == 0 )
+        op = REDUCE_SUM;
+    else if( strcmp( name, "minmax" ) == 0 )
+        op = REDUCE_MINMAX;
+    else if( strcmp( name, "topk" ) == 0 )
+        op = REDUCE_TOPK_MERGE;
+    else
+        return false;
+
+    return true;
+}
+
+const char *reduceOpName()
+{
+    switch( gtp.reduce_op )
+    {
+        case REDUCE_SUM:            return "sum";
+        case REDUCE_MINMAX:         return "min/max";
+        case REDUCE_TOPK_MERGE:     return "top-k merge";
+        default:                    return "none";
+    }
+}
+
+struct ReducePartial
+{
+    float sum;
+    float min;
+    float max;
+    float top[REDUCE_TOPK];     // descending
+    int topCount;
+
+    void clear()
+    {
+        sum = 0;
+        min = std::numeric_limits<float>::max();
+        max = -std::numeric_limits<float>::max();
+        topCount = 0;
+    }
+
+    void insertTop( float v )
+    {
+        if( (topCount == REDUCE_TOPK) && !(v > top[REDUCE_TOPK - 1]) )
+            return;
+
+        int j = std::min( topCount, REDUCE_TOPK - 1 );
+        while( (j > 0) && (top[j - 1] < v) )
+        {
+            top[j] = top[j - 1];
+            --j;
+        }
+        top[j] = v;
+
+        topCount = std::min( topCount + 1, REDUCE_TOPK );
+    }
+
+    void merge( const ReducePartial &other )
+    {
+        sum += other.sum;
+        min = std::min( min, other.min );
+        max = std::max( max, other.max );
+
+        for( int k = 0; k < other.topCount; ++k )
+            insertTop( other.top[k] );
+    }
+};
+
+//
+// kernels
+//
+
+void foldSum( const float *v, int n, ReducePartial &p )
+{
+    int i = 0;
+    float sum = 0;
+
+#if defined(_M_X64) || defined(_M_IX86)
+    // independent accumulators hide the add latency
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    __m128 a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+
+    for( ; i + 16 <= n; i += 16 )
+    {
+        a0 = _mm_add_ps( a0, _mm_loadu_ps( v + i ) );
+        a1 = _mm_add_ps( a1, _mm_loadu_ps( v + i + 4 ) );
+        a2 = _mm_add_ps( a2, _mm_loadu_ps( v + i + 8 ) );
+        a3 = _mm_add_ps( a3, _mm_loadu_ps( v + i + 12 ) );
+    }
+
+    float lanes[4];
+    _mm_storeu_ps( lanes, _mm_add_ps( _mm_add_ps( a0, a1 ), _mm_add_ps( a2, a3 ) ) );
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+    for( ; i < n; ++i )
+        sum += v[i];
+
+    p.sum += sum;
+}
+
+void foldMinMax( const float *v, int n, ReducePartial &p )
+{
+    int i = 0;
+
+#if defined(_M_X64) || defined(_M_IX86)
+    __m128 mn = _mm_set1_ps( p.min );
+    __m128 mx = _mm_set1_ps( p.max );
+
+    for( ; i + 4 <= n; i += 4 )
+    {
+        __m128 x = _mm_loadu_ps( v + i );
+        mn = _mm_min_ps( mn, x );
+        mx = _mm_max_ps( mx, x );
+    }
+
+    float lanes[4];
+    _mm_storeu_ps( lanes, mn );
+    for( float l : lanes ) p.min = std::min( p.min, l );
+    _mm_storeu_ps( lanes, mx );
+    for( float l : lanes ) p.max = std::max( p.max, l );
+#endif
+
+    for( ; i < n; ++i )
+    {
+        p.min = std::min( p.min, v[i] );
+        p.max = std::max( p.max, v[i] );
+    }
+}
+
+void foldTopK( const float *v, int n, ReducePartial &p )
+{
+    int i = 0;
+
+#if defined(_M_X64) || defined(_M_IX86)
+    for( ; i + 4 <= n; i += 4 )
+    {
+        const float threshold = (p.topCount == REDUCE_TOPK) ?
+            p.top[REDUCE_TOPK - 1] : -std::numeric_limits<float>::max();
+
+        __m128 x = _mm_loadu_ps( v + i );
+        int mask = _mm_movemask_ps( _mm_cmpgt_ps( x, _mm_set1_ps( threshold ) ) );
+
+        // almost always zero once the top k has filled up
+        while( mask )
+        {
+            unsigned long lane;
+            _BitScanForward( &lane, mask );
+            p.insertTop( v[i + lane] );
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for( ; i < n; ++i )
+        p.insertTop( v[i] );
+}
+
+//
+// reduce state and thread pool
+//
+
+struct ReduceItem
+{
+    int client_num;
+    int iter;
+    const char *buf;
+    int len;
+};
+
+struct ReduceSlot
+{
+    volatile LONG pending;      // folds still to come for its volley
+    std::vector<ReducePartial> partials;
+};
+
+struct ReduceState
+{
+    ReduceSlot slots[2];        // by volley parity
+    std::vector<__int64> done;  // per volley, when its reduce finished
+    ReducePartial result;       // of the last volley
+
+    volatile LONG64 fold_ticks;
+    volatile LONG folds;
+
+    // the pool
+    std::vector<HANDLE> workers;
+    std::deque<ReduceItem> queue;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE ready;
+    CONDITION_VARIABLE merged;  // a volley's done was set, under lock
+    bool stopping;
+    std::vector<HANDLE> idle;   // per client and buffer, set while no fold is queued
+
+    ReduceState()
+    {
+        InitializeCriticalSection( &lock );
+        InitializeConditionVariable( &ready );
+        InitializeConditionVariable( &merged );
+    }
+} reduceState;
+
+void reduceFanIn( int client_num, int iter, const char *buf, int len )
+{
+    __int64 start = qpc();
+
+    ReduceSlot &slot = reduceState.slots[iter % 2];
+    ReducePartial &p = slot.partials[client_num];
+    p.clear();
+
+    const float *v = (const float *) buf;
+    const int n = len / sizeof(float);
+
+    switch( gtp.reduce_op )
+    {
+        case REDUCE_SUM:        foldSum( v, n, p ); break;
+        case REDUCE_MINMAX:     foldMinMax( v, n, p ); break;
+        case REDUCE_TOPK_MERGE: foldTopK( v, n, p ); break;
+        default:                HARD_ASSERT( UNREACHED );
+    }
+
+    InterlockedExchangeAdd64( &reduceState.fold_ticks, qpc() - start );
+    InterlockedIncrement( &reduceState.folds );
+
+    if( InterlockedDecrement( &slot.pending ) == 0 )
+    {
+        ReducePartial r;
+        r.clear();
+        for( auto &q : slot.partials )
+            r.merge( q );
+
+        reduceState.result = r;
+        const __int64 now = qpc();
+
+        // ready for the volley after next, which can't start on the slot
+        // until it sees this one merged
+        slot.pending = incastClients();
+
+        EnterCriticalSection( &reduceState.lock );
+        reduceState.done[iter] = now;
+        LeaveCriticalSection( &reduceState.lock );
+        WakeAllConditionVariable( &reduceState.merged );
+    }
+}
+
+unsigned int __stdcall reduceWorker( void * )
+{
+    while( true )
+    {
+        EnterCriticalSection( &reduceState.lock );
+
+        while( reduceState.queue.empty() && !reduceState.stopping )
+        {
+            SleepConditionVariableCS( &reduceState.ready, &reduceState.lock, INFINITE );
+        }
+
+        if( reduceState.queue.empty() )
+        {
+            LeaveCriticalSection( &reduceState.lock );
+            break;
+        }
+
+        ReduceItem item = reduceState.queue.front();
+        reduceState.queue.pop_front();
+
+        LeaveCriticalSection( &reduceState.lock );
+
+        reduceFanIn( item.client_num, item.iter, item.buf, item.len );
+        SetEvent( reduceState.idle[item.client_num * 2 + item.iter % 2] );
+    }
+
+    return 0;
+}
+
+// runTest, before the serverThreads start
+void reduceStart()
+{
+    const int clients = incastClients();
+
+    for( auto &slot : reduceState.slots )
+    {
+        slot.pending = clients;
+        slot.partials.assign( clients, ReducePartial() );
+    }
+
+    reduceState.done.assign( gtp.iters, 0 );
+    reduceState.fold_ticks = 0;
+    reduceState.folds = 0;
+
+    if( gtp.reduce_threads == 0 )
+        return;
+
+    reduceState.stopping = false;
+
+    for( int k = 0; k < 2 * clients; ++k )
+        reduceState.idle.push_back( CreateEvent( NULL, TRUE, TRUE, NULL ) );
+
+    for( int t = 0; t < gtp.reduce_threads; ++t )
+    {
+        reduceState.workers.push_back(
+            (HANDLE) _beginthreadex( NULL, 0, reduceWorker, NULL, 0, NULL ) );
+    }
+}
+
+// runTest, once the serverThreads are done
+void reduceStop()
+{
+    if( gtp.reduce_threads == 0 )
+        return;
+
+    EnterCriticalSection( &reduceState.lock );
+    reduceState.stopping = true;
+    LeaveCriticalSection( &reduceState.lock );
+    WakeAllConditionVariable( &reduceState.ready );
+
+    waitForThreads( reduceState.workers );
+
+    for( auto h : reduceState.workers )
+        CloseHandle( h );
+    for( auto h : reduceState.idle )
+        CloseHandle( h );
+
+    reduceState.workers.clear();
+    reduceState.idle.clear();
+}
+
+// serverThread, before reusing the buffer and slot of volley iter - 2
+void reduceWaitBuffer( int client_num, int iter )
+{
+    WaitForSingleObject( reduceState.idle[client_num * 2 + iter % 2], INFINITE );
+
+    if( iter < 2 )
+        return;
+
+    EnterCriticalSection( &reduceState.lock );
+    while( reduceState.done[iter - 2] == 0 )
+    {
+        SleepConditionVariableCS( &reduceState.merged, &reduceState.lock, INFINITE );
+    }
+    LeaveCriticalSection( &reduceState.lock );
+}
+
+// serverThread, after its last volley
+void reduceDrain( int client_num )
+{
+    reduceWaitBuffer( client_num, 0 );
+    reduceWaitBuffer( client_num, 1 );
+}
+
+void reducePost( int client_num, int iter, const char *buf, int len )
+{
+    ReduceItem item = { client_num, iter, buf, len };
+
+    ResetEvent( reduceState.idle[client_num * 2 + iter % 2] );
+
+    EnterCriticalSection( &reduceState.lock );
+    reduceState.queue.push_back( item );
+    LeaveCriticalSection( &reduceState.lock );
+    WakeConditionVariable( &reduceState.ready );
+}
+
+// client side: plain floats to reduce, unless the payload is verified
+void fillReduceValues( char *buf, int size, int client_num )
+{
+    unsigned x = 2654435761u * (client_num + 1);
+
+    for( int i = 0; i + (int) sizeof(float) <= size; i += sizeof(float) )
+    {
+        x = x * 1664525 + 1013904223;
+        float v = (x >> 8) / 16777216.0f * 1000;
+        memcpy( buf + i, &v, sizeof(v) );
+    }
+}
+
+void reportReduce()
+{
+    using namespace std;
+
+    if( gtp.reduce_op == REDUCE_NONE )
+        return;
+
+    // fan-in received to volley reduced
+    Histogram<__int64> endToEnd;
+
+    for( int i = 0; i < gtp.iters; ++i )
+    {
+        __int64 firstStart = numeric_limits<__int64>::max();
+        for( auto &tr : clientResults )
+            firstStart = min( firstStart, tr.measurements[i].start );
+
+        endToEnd.add( reduceState.done[i] - firstStart );
+    }
+
+    printf( "\nReduce (%s, ", reduceOpName() );
+    if( gtp.reduce_threads > 0 )
+        printf( "%d pool threads):\n", gtp.reduce_threads );
+    else
+        printf( "inline):\n" );
+
+    const double foldUsec = reduceState.fold_ticks * 1.0e6 / freq;
+    printf( "\tusec per fan-in:      %10.3f\n", foldUsec / reduceState.folds );
+    printf( "\tusec per volley:      %10.3f\n", foldUsec / gtp.iters );
+    printf( "\tend-to-end median:    %10.3f\n", endToEnd.get_median() * 1.0e6 / freq );
+    printf( "\tend-to-end 99th %%ile: %10.3f\n", endToEnd.get_percentile(0.99) * 1.0e6 / freq );
+    printf( "\tend-to-end maximum:   %10.3f\n", endToEnd.get_max() * 1.0e6 / freq );
+}
+
+#endif // _INCAST_REDUCE_H
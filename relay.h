@@ -0,0 +1,491 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_RELAY_H
+#define _INCAST_RELAY_H
+
+#include <deque>
+
+// Bottleneck relay.  Clients connect to the relay, which opens a matching
+// connection to the server and forwards both byte streams.  Everything
+// the clients send goes through one shared egress queue, drained at a
+// fixed rate, so the fan-ins contend for a single slow, shallow port the
+// way they would at a switch.  Server to client traffic is forwarded as
+// is.
+//
+// A byte stream can't lose a segment without breaking the test, so when
+// the queue is full the relay stops reading from the clients instead of
+// dropping.  Their TCP windows close and they back off.
+
+const unsigned RELAY_PORT = PORT + 1000;
+const int RELAY_SEGMENT = 1460;
+const int RELAY_REVERSE_BUFFER = 64 * 1024;
+
+struct RelayParameters
+{
+    unsigned port;          // first port the relay listens on
+    double rate_mbps;       // egress queue drain rate
+    int buffer;             // egress queue limit, bytes
+
+    RelayParameters()
+        : port(RELAY_PORT)
+        , rate_mbps(1000)
+        , buffer(128 * 1024)
+    {};
+} relayParams;
+
+struct RelayStats
+{
+    __int64 bytes;          // forwarded through the egress queue
+    int stalls;             // times the queue filled up
+    int max_queue;
+    double queue_ticks;     // queued bytes integrated over time
+    __int64 full_ticks;
+    __int64 start;
+
+    RelayStats()
+        : bytes(0)
+        , stalls(0)
+        , max_queue(0)
+        , queue_ticks(0)
+        , full_ticks(0)
+        , start(qpc())
+    {};
+};
+
+class BottleneckRelay
+{
+    struct Segment
+    {
+        int conn;
+        int len;
+        int sent;
+        char data[RELAY_SEGMENT];
+    };
+
+    struct Connection
+    {
+        SOCKET down;        // to the client
+        SOCKET up;          // to the server
+        int queued;         // bytes waiting in the egress queue
+        bool down_eof;
+        bool up_eof;
+        bool up_shut;
+        bool down_shut;
+        bool broken;
+        std::unique_ptr<char[]> reverse;
+        int reverse_len;
+        int reverse_sent;
+    };
+
+    std::vector<SOCKET> listeners_;
+    SOCKADDR_INET server_;
+    std::map<int, Connection> conns_;
+    int next_id_;
+
+    std::deque<Segment> queue_;
+    int queue_bytes_;
+    bool full_;
+    double credit_;         // bytes the egress port may send now
+    double bytes_per_tick_;
+    __int64 last_;
+
+    RelayStats stats_;
+
+    void accept( int k )
+    {
+        SOCKADDR_INET client = {0};
+        int nlen = sizeof(client);
+
+        SOCKET down = ::accept( listeners_[k], (SOCKADDR*) &client, &nlen );
+        if( down == INVALID_SOCKET )
+        {
+            fprintf(stderr, "accept() failed: %d\n", WSAGetLastError());
+            return;
+        }
+        unmapAddress( client );
+
+        SOCKET up;
+        if ((up = socket(server_.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+        {
+            fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        // a client on a loopback address of its own, see launcher.h,
+        // reaches the server from that address through us too
+        if( (client.si_family == AF_INET) && (server_.si_family == AF_INET) &&
+            ((ntohl( client.Ipv4.sin_addr.s_addr ) >> 24) == 127) )
+        {
+            client.Ipv4.sin_port = 0;
+            if (bind(up, (SOCKADDR*) &client, sizeof(SOCKADDR_IN)) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "relay bind() to client address failed: %d\n", WSAGetLastError());
+            }
+        }
+
+        // listen port k forwards to server port k
+        SOCKADDR_INET sin = server_;
+        setAddressPort( sin, basePort + k );
+
+        if (connect(up, (SOCKADDR*) &sin, addressLength(sin)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "relay connect() to server failed: %d\n", WSAGetLastError());
+            closesocket(down);
+            closesocket(up);
+            return;
+        }
+
+        // the relay itself must not hold anything back
+        disableNagle(down);
+        disableNagle(up);
+        setNonBlocking(down);
+        setNonBlocking(up);
+
+        // statistics cover one test, from its first connection
+        if( conns_.empty() )
+        {
+            stats_ = RelayStats();
+        }
+
+        Connection &c = conns_[next_id_++];
+        c.down = down;
+        c.up = up;
+        c.queued = 0;
+        c.down_eof = c.up_eof = c.up_shut = c.down_shut = c.broken = false;
+        c.reverse.reset( new char[RELAY_REVERSE_BUFFER] );
+        c.reverse_len = c.reverse_sent = 0;
+    }
+
+    void fail( Connection &c, const char *what )
+    {
+        int err = WSAGetLastError();
+
+        // clients that quit with CTRL-C reset their connections
+        if( err != WSAECONNRESET && err != WSAECONNABORTED )
+        {
+            fprintf(stderr, "relay %s failed: %d\n", what, err);
+        }
+
+        closesocket(c.down);
+        closesocket(c.up);
+        c.broken = true;
+    }
+
+    // one segment per readable client per pass, so fan-ins interleave
+    // in the queue the way packets would
+    void readClient( int id, Connection &c )
+    {
+        Segment seg;
+        seg.conn = id;
+        seg.sent = 0;
+
+        int bytes = recv(c.down, seg.data, RELAY_SEGMENT, 0);
+        if( bytes == SOCKET_ERROR )
+        {
+            if( WSAGetLastError() != WSAEWOULDBLOCK )
+                fail( c, "recv() from client" );
+            return;
+        }
+
+        if( bytes == 0 )
+        {
+            c.down_eof = true;
+            return;
+        }
+
+        seg.len = bytes;
+        queue_.push_back( seg );
+        c.queued += bytes;
+        queue_bytes_ += bytes;
+        stats_.max_queue = std::max( stats_.max_queue, queue_bytes_ );
+    }
+
+    void readServer( Connection &c )
+    {
+        int bytes = recv(c.up, c.reverse.get(), RELAY_REVERSE_BUFFER, 0);
+        if( bytes == SOCKET_ERROR )
+        {
+            if( WSAGetLastError() != WSAEWOULDBLOCK )
+                fail( c, "recv() from server" );
+            return;
+        }
+
+        if( bytes == 0 )
+        {
+            c.up_eof = true;
+            return;
+        }
+
+        c.reverse_len = bytes;
+        c.reverse_sent = 0;
+    }
+
+    void writeClient( Connection &c )
+    {
+        int bytes = send(c.down, c.reverse.get() + c.reverse_sent, c.reverse_len - c.reverse_sent, 0);
+        if( bytes == SOCKET_ERROR )
+        {
+            if( WSAGetLastError() != WSAEWOULDBLOCK )
+                fail( c, "send() to client" );
+            return;
+        }
+
+        if( (c.reverse_sent += bytes) == c.reverse_len )
+        {
+            c.reverse_len = c.reverse_sent = 0;
+        }
+    }
+
+    void drain( __int64 now )
+    {
+        const double burst = 2 * RELAY_SEGMENT;
+
+        credit_ = std::min( credit_ + (now - last_) * bytes_per_tick_, burst );
+
+        while( !queue_.empty() )
+        {
+            Segment &seg = queue_.front();
+            Connection &c = conns_[seg.conn];
+            int bytes = seg.len - seg.sent;
+
+            if( !c.broken )
+            {
+                // a segment leaves the port whole, once the link has
+                // had time to serialize it
+                if( credit_ < bytes )
+                    break;
+
+                bytes = send(c.up, seg.data + seg.sent, bytes, 0);
+                if( bytes == SOCKET_ERROR )
+                {
+                    if( WSAGetLastError() == WSAEWOULDBLOCK )
+                        break;
+
+                    fail( c, "send() to server" );
+                    bytes = seg.len - seg.sent;
+                }
+                else
+                {
+                    credit_ -= bytes;
+                    stats_.bytes += bytes;
+                }
+            }
+
+            if( (seg.sent += bytes) < seg.len )
+                break;
+
+            c.queued -= seg.len;
+            queue_bytes_ -= seg.len;
+            queue_.pop_front();
+        }
+    }
+
+    void account( __int64 now )
+    {
+        stats_.queue_ticks += (double) queue_bytes_ * (now - last_);
+
+        if( full_ )
+            stats_.full_ticks += now - last_;
+
+        bool full = queue_bytes_ + RELAY_SEGMENT > relayParams.buffer;
+        if( full && !full_ )
+            stats_.stalls++;
+        full_ = full;
+    }
+
+    // close both halves once everything in flight has been delivered
+    void finish()
+    {
+        for( auto i = conns_.begin(); i != conns_.end(); )
+        {
+            Connection &c = i->second;
+
+            if( !c.broken )
+            {
+                if( c.down_eof && (c.queued == 0) && !c.up_shut )
+                {
+                    shutdown(c.up, SD_SEND);
+                    c.up_shut = true;
+                }
+
+                if( c.up_eof && (c.reverse_len == 0) && !c.down_shut )
+                {
+                    shutdown(c.down, SD_SEND);
+                    c.down_shut = true;
+                }
+
+                if( c.up_shut && c.down_shut )
+                {
+                    closesocket(c.down);
+                    closesocket(c.up);
+                    c.broken = true;
+                }
+            }
+
+            if( c.broken && (c.queued == 0) )
+                i = conns_.erase( i );
+            else
+                ++i;
+        }
+    }
+
+    public:
+
+    BottleneckRelay( const std::vector<SOCKET> &listeners, const SOCKADDR_INET &server )
+        : listeners_(listeners)
+        , server_(server)
+        , next_id_(0)
+        , queue_bytes_(0)
+        , full_(false)
+        , credit_(0)
+        , last_(qpc())
+    {
+        bytes_per_tick_ = relayParams.rate_mbps * 1.0e6 / 8 / freq;
+    }
+
+    void run()
+    {
+        std::vector<WSAPOLLFD> fds;
+        std::vector<int> owner;     // connection id, or -1 - listener index
+
+        while( true )
+        {
+            fds.clear();
+            owner.clear();
+
+            for( unsigned k = 0; k < listeners_.size(); ++k )
+            {
+                WSAPOLLFD pfd = { listeners_[k], POLLRDNORM, 0 };
+                fds.push_back( pfd );
+                owner.push_back( -1 - (int) k );
+            }
+
+            for( auto &i : conns_ )
+            {
+                Connection &c = i.second;
+                if( c.broken )
+                    continue;
+
+                // back-pressure: leave the clients' data in their sockets
+                SHORT down = 0;
+                if( !c.down_eof && !full_ )
+                    down |= POLLRDNORM;
+                if( c.reverse_len > 0 )
+                    down |= POLLWRNORM;
+
+                SHORT up = 0;
+                if( !c.up_eof && (c.reverse_len == 0) )
+                    up |= POLLRDNORM;
+
+                WSAPOLLFD pd = { c.down, down, 0 };
+                WSAPOLLFD pu = { c.up, up, 0 };
+                fds.push_back( pd );
+                owner.push_back( i.first );
+                fds.push_back( pu );
+                owner.push_back( i.first );
+            }
+
+            // spin while the egress port is busy so it runs at the
+            // configured rate rather than at timer resolution
+            if (WSAPoll(&fds[0], fds.size(), queue_.empty() ? 10 : 0) == SOCKET_ERROR)
+            {
+                fprintf(stderr, "WSAPoll() failed: %d\n", WSAGetLastError());
+                exit(-1);
+            }
+
+            __int64 now = qpc();
+            account( now );
+            drain( now );
+            last_ = now;
+
+            for( unsigned f = 0; f < fds.size(); ++f )
+            {
+                if( fds[f].revents == 0 )
+                    continue;
+
+                if( owner[f] < 0 )
+                {
+                    accept( -1 - owner[f] );
+                    continue;
+                }
+
+                Connection &c = conns_[owner[f]];
+                if( c.broken )
+                    continue;
+
+                // errors and hang-ups surface through recv() and send()
+                const bool isDown = (fds[f].fd == c.down);
+                const SHORT rd = POLLRDNORM | POLLERR | POLLHUP;
+
+                if( isDown )
+                {
+                    if( (fds[f].events & POLLRDNORM) && (fds[f].revents & rd) && !full_ )
+                    {
+                        readClient( owner[f], c );
+                        account( now );
+                    }
+                    if( !c.broken && (fds[f].revents & POLLWRNORM) )
+                        writeClient( c );
+                }
+                else if( (fds[f].events & POLLRDNORM) && (fds[f].revents & rd) )
+                {
+                    readServer( c );
+
+                    // forward the fan-out right away
+                    if( !c.broken && (c.reverse_len > 0) )
+                        writeClient( c );
+                }
+            }
+
+            bool active = !conns_.empty();
+            finish();
+
+            // a test ends when the server closes its connections
+            if( active && conns_.empty() )
+            {
+                report();
+            }
+        }
+    }
+
+    void report()
+    {
+        double seconds = ((double) (qpc() - stats_.start)) / freq;
+
+        printf( "\nRelay egress queue:\n" );
+        printf( "\trate mbit/sec:        %10.3f\n", relayParams.rate_mbps );
+        printf( "\tbuffer bytes:         %10d\n", relayParams.buffer );
+        printf( "\tforwarded MB:         %10.3f\n", stats_.bytes / 1.0e6 );
+        printf( "\tachieved mbit/sec:    %10.3f\n", stats_.bytes * 8 / seconds / 1.0e6 );
+        printf( "\tavg queue bytes:      %10.0f\n", stats_.queue_ticks / (seconds * freq) );
+        printf( "\tmax queue bytes:      %10d\n", stats_.max_queue );
+        printf( "\tqueue full events:    %10d\n", stats_.stalls );
+        printf( "\ttime full:            %9.3f%%\n", 100.0 * stats_.full_ticks / (seconds * freq) );
+    }
+};
+
+#endif // _INCAST_RELAY_H
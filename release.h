@@ -0,0 +1,133 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_RELEASE_H
+#define _INCAST_RELEASE_H
+
+// Barrier release skew.  A volley's fan-out is only as synchronized as
+// barrier::wait makes it.  The last serverThread to arrive stamps the
+// barrier once its onRelease work is done, just as it wakes the others,
+// and each thread takes m.start as soon as it wakes, so m.start -
+// m.release is how long after the release that thread began its
+// fan-out.  That part of the volley's spread is the harness's,
+// not the network's; the trace keeps both so an analysis can take it
+// out, and -bs rejects a run where it gets too large.
+
+const int RELEASE_SLOWEST = 5;
+
+struct ReleaseSkew
+{
+    double threshold_usec;  // -bs, 0 for none
+    bool rejected;          // some run went over it
+
+    ReleaseSkew()
+        : threshold_usec(0)
+        , rejected(false)
+    {};
+} releaseSkew;
+
+void reportReleaseSkew()
+{
+    const int clients = clientResults.size();
+    if( (clients == 0) || (gtp.iters == 0) )
+        return;
+
+    const double usec = 1.0e6 / freq;
+
+    Histogram<__int64> volleyMax, volley99;
+    std::vector<__int64> wake( clients );
+    std::vector<double> threadTotal( clients, 0 );
+
+    // volleys by their slowest wake-up, in power of two usec buckets
+    std::map<int, int> buckets;
+
+    for( int i = 0; i < gtp.iters; ++i )
+    {
+        for( int c = 0; c < clients; ++c )
+        {
+            const Measurement &m = clientResults[c].measurements[i];
+            wake[c] = m.start - m.release;
+            threadTotal[c] += wake[c];
+        }
+
+        std::sort( wake.begin(), wake.end() );
+        volleyMax.add( wake.back() );
+        volley99.add( wake[std::min( clients - 1, clients * 99 / 100 )] );
+
+        int b = 0;
+        while( (b < 30) && (wake.back() * usec >= (1 << b)) )
+            b++;
+        buckets[b]++;
+    }
+
+    printf( "\nBarrier release skew, usec after the release:\n" );
+    printf( "\t                      %10s %10s %10s\n", "median", "99th", "max" );
+    printf( "\tvolley max:           %10.3f %10.3f %10.3f\n",
+        volleyMax.get_median() * usec, volleyMax.get_percentile(0.99) * usec, volleyMax.get_max() * usec );
+    printf( "\tvolley 99th %%ile:     %10.3f %10.3f %10.3f\n",
+        volley99.get_median() * usec, volley99.get_percentile(0.99) * usec, volley99.get_max() * usec );
+
+    printf( "\tvolleys by max:\n" );
+    for( auto &b : buckets )
+    {
+        printf( "\t    < %8d usec:  %10d\n", 1 << b.first, b.second );
+    }
+
+    // per thread, the average wake-up delay, and the slowest threads
+    std::vector<int> order( clients );
+    double total = 0;
+    for( int c = 0; c < clients; ++c )
+    {
+        order[c] = c;
+        total += threadTotal[c];
+    }
+
+    std::sort( order.begin(), order.end(),
+        [&]( int a, int b ) { return threadTotal[a] > threadTotal[b]; } );
+
+    printf( "\tthread avg, mean:     %10.3f\n", total / clients / gtp.iters * usec );
+
+    for( int k = 0; k < std::min( clients, RELEASE_SLOWEST ); ++k )
+    {
+        printf( "\tthread avg, client %3d:%9.3f\n",
+            order[k], threadTotal[order[k]] / gtp.iters * usec );
+    }
+
+    if( gtp.histogram )
+    {
+        histfile << std::endl << "Release skew" << std::endl;
+        histfile << volleyMax.get_histogram_csv( 1000 );
+    }
+
+    if( (releaseSkew.threshold_usec > 0) &&
+        (volleyMax.get_percentile(0.99) * usec > releaseSkew.threshold_usec) )
+    {
+        printf( "\t99th %%ile volley max above %.3f usec: run rejected\n", releaseSkew.threshold_usec );
+        releaseSkew.rejected = true;
+    }
+}
+
+#endif // _INCAST_RELEASE_H
@@ -0,0 +1,390 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_REPORT_H
+#define _INCAST_REPORT_H
+
+// Test parameter and latency/throughput reports, shared by real and
+// simulated runs and by the benchmarks.
+
+void reportGlobalTestParameters()
+{
+    printf( "\n" );
+    printf( "Test parameters:\n" );
+    printf( "\tclients:              %d\n", gtp.clients );
+    printf( "\titerations:           %d\n", gtp.iters );
+    if( gtp.rate_limited )
+    {
+        printf( "\trate limit:           %d\n", gtp.target_rate );
+    }
+    else
+    {
+        printf( "\trate limit:           none\n" );
+    }
+    printf( "\tfan-out msg bytes:    %d\n", gtp.fo_msg_size );
+    printf( "\tfan-in msg bytes:     %d\n", gtp.fi_msg_size );
+    printf( "\tlisten ports:         %d (accept threads: %d each)\n", listenPorts, acceptThreadsPerPort );
+    printf( "\ttraffic pattern:      %s\n", gtp.shuffle ? "all-to-all shuffle" : "incast" );
+    printf( "\tcongestion control:   %s\n", congestionDescription().c_str() );
+   
+    printf( "\tNagle's algorithm:    %s\n", gtp.nagle ? "enabled" : "disabled" );
+
+    if( gtp.send_buffer >= 0 )
+    {
+        printf( "\tsend buffer size:     %d\n", gtp.send_buffer );
+    }
+    else
+    {
+        printf( "\tsend buffer size:     OS default\n" );
+    }
+
+    if( gtp.recv_buffer >= 0 )
+    {
+        printf( "\treceive buffer size:  %d\n", gtp.recv_buffer );
+    }
+    else
+    {
+        printf( "\treceive buffer size:  OS default\n" );
+    }
+    
+    if( gtp.busy_poll_usec > 0 )
+    {
+        printf( "\tbusy poll budget:     %d usec\n", gtp.busy_poll_usec );
+    }
+    else
+    {
+        printf( "\tbusy poll budget:     none\n" );
+    }
+
+    if( gtp.delay > 0 )
+    {
+        printf( "\tdelay:                %d\n", gtp.delay );
+        printf( "\tdelay method:         %s\n", 
+            gtp.delay_method == RANDOM_JITTER ? "random jitter" : "uniform sched" );
+    }
+    else
+    {
+        printf( "\tdelay:               none\n" );
+    }
+}
+
+// call before reportLatencyThroughput, which takes any delay out of
+// the measurements
+TestSummary summarizeTest()
+{
+    using namespace std;
+
+    Histogram<__int64> hist;
+    __int64 globalFirstStart = 0, globalLastStop = 0;
+
+    for( int i = 0; i < gtp.iters; ++i )
+    {
+        __int64 firstStart = numeric_limits<__int64>::max();
+        __int64 lastStop = numeric_limits<__int64>::min();
+
+        for( auto &tr : clientResults )
+        {
+            firstStart = min( firstStart, tr.measurements[i].start );
+            lastStop = max( lastStop, tr.measurements[i].stop );
+        }
+
+        hist.add( lastStop - firstStart );
+
+        if( i == 0 ) globalFirstStart = firstStart;
+        if( i == gtp.iters-1 ) globalLastStop = lastStop;
+    }
+
+    const double totalSeconds = ((double) (globalLastStop - globalFirstStart)) / freq;
+
+    TestSummary t;
+    t.median_usec = hist.get_median() * 1.0e6 / freq;
+    t.p99_usec = hist.get_percentile(0.99) * 1.0e6 / freq;
+    t.max_usec = hist.get_max() * 1.0e6 / freq;
+    t.recv_mbps = gtp.fi_msg_size * 8.0 * clientResults.size() * gtp.iters / totalSeconds / 1.0e6;
+    t.iters_per_sec = gtp.iters / totalSeconds;
+    t.retransmits = (tcpStatsAfter.dwRetransSegs - tcpStatsBefore.dwRetransSegs) + clientRetransmits();
+
+    return t;
+}
+
+void reportLatencyThroughput()
+{
+    using namespace std;
+
+    try {
+
+    Histogram<__int64> hist;
+    __int64 globalFirstStart, globalLastStop;
+    __int64 totalVolleyTicks = 0;
+
+    int clients = clientResults.size();
+
+    for( int i = 0; i < gtp.iters; ++i )
+    {
+        __int64 firstStart = numeric_limits<__int64>::max();
+        __int64 lastStop = numeric_limits<__int64>::min();
+
+        for( int c = 0; c < clients; ++c )
+        {
+            Measurements &m = clientResults[c].measurements;
+            firstStart = min( firstStart, m[i].start );
+            lastStop = max( lastStop, m[i].stop );
+        }
+    
+        HARD_ASSERT(lastStop>firstStart);
+        
+        hist.add(lastStop-firstStart);
+        totalVolleyTicks += lastStop-firstStart;
+
+        if( i == 0 ) globalFirstStart = firstStart;
+        if( i == gtp.iters-1 ) globalLastStop = lastStop;
+    }
+   
+    // for delay, we also calculate the exclusive latency
+    // by subtracting the actual per-client, per-iteration
+    // delay, thus effectively pretending that all the
+    // tests began at exactly the same time
+    
+    Histogram<__int64> exclusive_hist;
+
+#ifdef REPORT_DELAY
+    Histogram<__int64> delay_hist;
+#endif
+
+    if( gtp.delay )
+    {
+        for( int i = 0; i < gtp.iters; ++i )
+        {
+            for( int c = 0; c < clients; ++c )
+            {
+                Measurements &m = clientResults[c].measurements;
+#ifdef REPORT_DELAY
+                delay_hist.add(m[i].actual_delay);
+#endif
+                m[i].stop -= m[i].actual_delay;
+
+            }
+            
+            __int64 firstStart = numeric_limits<__int64>::max();
+            __int64 lastStop = numeric_limits<__int64>::min();
+
+            for( int c = 0; c < clients; ++c )
+            {
+                Measurements &m = clientResults[c].measurements;
+                
+                firstStart = min( firstStart, m[i].start );
+                lastStop = max( lastStop, m[i].stop );
+            }
+
+            HARD_ASSERT(lastStop>firstStart);
+
+            exclusive_hist.add(lastStop-firstStart);
+        }
+    }
+
+    if( gtp.histogram )
+    {
+        histfile << freq << endl << endl;
+        if( gtp.delay )
+        {
+#ifdef REPORT_DELAY
+            histfile << "Delay" << endl;
+            histfile << delay_hist.get_histogram_csv( 10000 ) << endl;
+#endif
+            histfile << "Exclusive" << endl;
+            histfile << exclusive_hist.get_histogram_csv( 10000 );
+            histfile << endl << "Inclusive" << endl;
+        }
+        histfile << hist.get_histogram_csv( 10000 );
+        histfile.close();
+    }
+   
+    if( gtp.delay )
+        printf( "\nLatency (inclusive):\n" );
+    else
+        printf( "\nLatency:\n" );
+
+    double lmin = hist.get_min() * 1.0e6 / freq;
+    printf( "\tminimum usec/iter:    %10.3f\n", lmin );
+    
+    double lmax = hist.get_max() * 1.0e6 / freq;
+    printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
+    
+    double avg = hist.get_avg() * 1.0e6 / freq;
+    printf( "\taverage usec/iter:    %10.3f\n", avg );
+    
+    double median = hist.get_median() * 1.0e6 / freq;
+    printf( "\tmedian usec/iter:     %10.3f\n", median );
+    
+    double p95 = hist.get_percentile(0.95) * 1.0e6 / freq;
+    printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
+    
+    double p99 = hist.get_percentile(0.99) * 1.0e6 / freq;
+    printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
+    
+    if( gtp.delay )
+    {
+        printf( "\nLatency (exclusive):\n" );
+
+        double lmin = exclusive_hist.get_min() * 1.0e6 / freq;
+        printf( "\tminimum usec/iter:    %10.3f\n", lmin );
+
+        double lmax = exclusive_hist.get_max() * 1.0e6 / freq;
+        printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
+
+        double avg = exclusive_hist.get_avg() * 1.0e6 / freq;
+        printf( "\taverage usec/iter:    %10.3f\n", avg );
+
+        double median = exclusive_hist.get_median() * 1.0e6 / freq;
+        printf( "\tmedian usec/iter:     %10.3f\n", median );
+
+        double p95 = exclusive_hist.get_percentile(0.95) * 1.0e6 / freq;
+        printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
+
+        double p99 = exclusive_hist.get_percentile(0.99) * 1.0e6 / freq;
+        printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
+       
+    }
+
+#ifdef REPORT_DELAY
+    if( gtp.delay )
+    {
+        printf( "\nJitter:\n" );
+
+        double lmin = delay_hist.get_min() * 1.0e6 / freq;
+        printf( "\tminimum usec/iter:    %10.3f\n", lmin );
+
+        double lmax = delay_hist.get_max() * 1.0e6 / freq;
+        printf( "\tmaximum usec/iter:    %10.3f\n", lmax );
+
+        double avg = delay_hist.get_avg() * 1.0e6 / freq;
+        printf( "\taverage usec/iter:    %10.3f\n", avg );
+
+        double median = delay_hist.get_median() * 1.0e6 / freq;
+        printf( "\tmedian usec/iter:     %10.3f\n", median );
+
+        double p95 = delay_hist.get_percentile(0.95) * 1.0e6 / freq;
+        printf( "\t95th %%ile usec/iter:  %10.3f\n", p95 );
+
+        double p99 = delay_hist.get_percentile(0.99) * 1.0e6 / freq;
+        printf( "\t99th %%ile usec/iter:  %10.3f\n", p99 );
+    }
+#endif
+
+    printf( "\nThroughput:\n" );
+    
+    double totalSeconds = ((double)(globalLastStop-globalFirstStart)) / freq;
+
+    if( gtp.shuffle )
+    {
+        reportShuffleThroughput( ((double) totalVolleyTicks) / freq );
+    }
+    else
+    {
+        double sendMBytes = gtp.fo_msg_size / 1.0e6 * clients * gtp.iters;
+        double recvMBytes = gtp.fi_msg_size / 1.0e6 * clients * gtp.iters;
+        double totalMBytes = sendMBytes + recvMBytes;
+
+        double sendMbps = sendMBytes * 8 / totalSeconds;
+        printf( "\tmbit/sec send:        %10.3f\n", sendMbps );
+
+        double recvMbps = recvMBytes * 8 / totalSeconds;
+        printf( "\tmbit/sec recv:        %10.3f\n", recvMbps );
+
+        double totalMbps = totalMBytes * 8 / totalSeconds;
+        printf( "\tmbit/sec tot:         %10.3f\n", totalMbps );
+    }
+  
+    double ips = gtp.iters / totalSeconds;
+    printf( "\titer/sec:             %10.3f\n", ips );
+    
+    const double FUDGE_FACTOR = 0.95;
+    if( gtp.rate_limited && (ips < gtp.target_rate * FUDGE_FACTOR ) )
+    {
+        printf( "\nWarning: missed target of %d iterations/sec\n", gtp.target_rate );
+    }
+    
+    }
+    catch( exception& e )
+    {
+        fprintf(stderr, "\nException caught: %s\n", e.what());
+    }
+}
+
+// The exchange latency we measure around send() and recv() against the
+// stack's RTT estimate for the same connections.  The difference is
+// roughly what the host adds: scheduling, system calls and copies on
+// both ends, plus the client's turnaround.
+void reportStackLatency()
+{
+    if( !gtp.stack_timing )
+        return;
+
+    Histogram<__int64> exchange;
+    Histogram<int> rtt;
+    int minRtt = -1;
+    int mss = 0;
+
+    for( unsigned c = 0; c < clientResults.size(); ++c )
+    {
+        const TestResult &tr = clientResults[c];
+
+        // reportLatencyThroughput has already taken out any delay
+        for( auto &m : tr.measurements )
+            exchange.add( m.stop - m.start );
+
+        for( auto r : tr.stack_rtt_usec )
+            rtt.add( r );
+
+        if( (tr.min_rtt_usec >= 0) && ((minRtt < 0) || (tr.min_rtt_usec < minRtt)) )
+            minRtt = tr.min_rtt_usec;
+
+        if( (tr.mss > 0) && ((mss == 0) || (tr.mss < mss)) )
+            mss = tr.mss;
+    }
+
+    printf( "\nStack latency (SIO_TCP_INFO):\n" );
+
+    if( rtt.get_sample_size() == 0 )
+    {
+        printf( "\tnot available, needs Windows 10 version 1703 or later\n" );
+        return;
+    }
+
+    double median = exchange.get_median() * 1.0e6 / freq;
+    printf( "\tmedian exchange usec: %10.3f\n", median );
+    printf( "\t99th %%ile exchange:   %10.3f\n", exchange.get_percentile(0.99) * 1.0e6 / freq );
+    printf( "\tmedian stack rtt usec:%10.3f\n", (double) rtt.get_median() );
+    printf( "\t99th %%ile stack rtt:  %10.3f\n", (double) rtt.get_percentile(0.99) );
+    printf( "\tminimum stack rtt:    %10.3f\n", (double) minRtt );
+
+    // a larger message takes more than one round trip, so the difference
+    // says nothing about the host then
+    if( (mss > 0) && (gtp.fo_msg_size <= mss) && (gtp.fi_msg_size <= mss) )
+        printf( "\test. host overhead:   %10.3f\n", median - rtt.get_median() );
+}
+
+#endif // _INCAST_REPORT_H
@@ -0,0 +1,224 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_SERVICE_H
+#define _INCAST_SERVICE_H
+
+#include <random>
+
+// Client service time.  A real leaf does some work between a request and
+// its answer, which spreads the fan-ins out by itself.  With -svc each
+// client spends time before every fan-in on one of
+//
+//     fixed USEC      spinning for a fixed time
+//     exp USEC        spinning for an exponentially distributed time
+//     hash BYTES      computing the CRC32C of a buffer, a CPU and memory
+//                     bound kernel whose time depends on the host
+//
+// and sends back how long each volley's work took, so the server can take
+// it out of the latency and report what the network added.
+
+bool parseServiceModel( const char *name, ServiceModel &model )
+{
+    if( strcmp( name, "fixed" ) == 0 )
+        model = SERVICE_FIXED;
+    else if( strcmp( name, "exp" ) == 0 )
+        model = SERVICE_EXPONENTIAL;
+    else if( strcmp( name, "hash" ) == 0 )
+        model = SERVICE_HASH;
+    else
+        return false;
+
+    return true;
+}
+
+const char *serviceDescription()
+{
+    switch( gtp.service_model )
+    {
+        case SERVICE_FIXED:         return "fixed usec";
+        case SERVICE_EXPONENTIAL:   return "exponential, mean usec";
+        case SERVICE_HASH:          return "CRC32C, bytes";
+        default:                    return "none";
+    }
+}
+
+class ServiceEmulator
+{
+public:
+
+    ServiceEmulator( int client_num )
+        : rng_( client_num + 1 )
+        , exp_( 1.0 / std::max( gtp.service_param, 1 ) )
+        , sink_( 0 )
+    {
+        if( gtp.service_model == SERVICE_HASH )
+        {
+            buf_.resize( gtp.service_param );
+            for( size_t i = 0; i < buf_.size(); ++i )
+                buf_[i] = (char) i;
+        }
+    }
+
+    // does one volley's work; returns how long it took, in usec
+    int serve()
+    {
+        __int64 start = qpc();
+
+        switch( gtp.service_model )
+        {
+            case SERVICE_FIXED:
+                spinUntil( start + (__int64) (gtp.service_param * 1.0e-6 * freq) );
+                break;
+
+            case SERVICE_EXPONENTIAL:
+                spinUntil( start + (__int64) (exp_( rng_ ) * 1.0e-6 * freq) );
+                break;
+
+            case SERVICE_HASH:
+                sink_ ^= crc32c( buf_.data(), buf_.size() );
+                break;
+
+            default:
+                return 0;
+        }
+
+        return (int) ((qpc() - start) * 1.0e6 / freq);
+    }
+
+private:
+
+    std::mt19937 rng_;
+    std::exponential_distribution<double> exp_;
+    std::vector<char> buf_;
+    volatile unsigned sink_;    // keeps the hash from being optimized away
+
+    // busy, like real work, rather than asleep
+    static void spinUntil( __int64 t )
+    {
+        while( qpc() < t )
+        {
+            YieldProcessor();
+        }
+    }
+};
+
+// clientMain, after its results: the service time of every measured volley
+void sendServiceTimes( SOCKET s, const std::vector<int> &usec )
+{
+    int bytes;
+    int count = (int) usec.size();
+
+    if ((bytes = send(s, (char*) &count, sizeof(count), 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() service times failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == sizeof(count));
+
+    if( count == 0 )
+        return;
+
+    const int size = count * sizeof(int);
+    if ((bytes = send(s, (char*) usec.data(), size, 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() service times failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == size);
+}
+
+void recvServiceTimes( SOCKET s, TestResult &tr )
+{
+    int bytes;
+    int count;
+
+    if ((bytes = recv(s, (char*) &count, sizeof(count), MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() service times failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == sizeof(count));
+    HARD_ASSERT(count == (int) tr.measurements.size());
+
+    tr.service_usec.resize( count );
+    if( count == 0 )
+        return;
+
+    const int size = count * sizeof(int);
+    if ((bytes = recv(s, (char*) tr.service_usec.data(), size, MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() service times failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == size);
+}
+
+// after reportLatencyThroughput, so any delay is already out too
+void reportService()
+{
+    using namespace std;
+
+    if( gtp.service_model == SERVICE_NONE )
+        return;
+
+    Histogram<int> service;
+    Histogram<__int64> network;
+
+    const int clients = clientResults.size();
+
+    for( int i = 0; i < gtp.iters; ++i )
+    {
+        __int64 firstStart = numeric_limits<__int64>::max();
+        __int64 lastStop = numeric_limits<__int64>::min();
+
+        for( int c = 0; c < clients; ++c )
+        {
+            const Measurement &m = clientResults[c].measurements[i];
+            const int usec = clientResults[c].service_usec[i];
+
+            service.add( usec );
+            firstStart = min( firstStart, m.start );
+            lastStop = max( lastStop, m.stop - (__int64) (usec * 1.0e-6 * freq) );
+        }
+
+        network.add( lastStop - firstStart );
+    }
+
+    printf( "\nClient service time (%s %d):\n", serviceDescription(), gtp.service_param );
+    printf( "\tmedian usec:          %10.3f\n", (double) service.get_median() );
+    printf( "\t99th %%ile usec:       %10.3f\n", (double) service.get_percentile(0.99) );
+    printf( "\tmaximum usec:         %10.3f\n", (double) service.get_max() );
+
+    printf( "\nLatency (service time subtracted):\n" );
+    printf( "\tminimum usec/iter:    %10.3f\n", network.get_min() * 1.0e6 / freq );
+    printf( "\tmedian usec/iter:     %10.3f\n", network.get_median() * 1.0e6 / freq );
+    printf( "\t95th %%ile usec/iter:  %10.3f\n", network.get_percentile(0.95) * 1.0e6 / freq );
+    printf( "\t99th %%ile usec/iter:  %10.3f\n", network.get_percentile(0.99) * 1.0e6 / freq );
+    printf( "\tmaximum usec/iter:    %10.3f\n", network.get_max() * 1.0e6 / freq );
+}
+
+#endif // _INCAST_SERVICE_H
@@ -0,0 +1,414 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_SHUFFLE_H
+#define _INCAST_SHUFFLE_H
+
+// All-to-all shuffle mode.
+//
+// The server hands every client the listening endpoint of every other
+// client.  Each client then connects to all of its peers, and each round
+// (the server's fan-out) every client sends a fi_msg_size partition to
+// every peer.  A client answers the server with a small "done" message
+// once it has sent and received all of its partitions, so the server's
+// per-client measurement covers the whole exchange.
+
+struct ShuffleListenInfo
+{
+    unsigned short port;    // network byte order
+};
+
+struct ShuffleMesh
+{
+    // out[j] carries partitions to peer j, in[j] carries partitions from
+    // peer j; both are INVALID_SOCKET for ourselves
+    std::vector<SOCKET> out;
+    std::vector<SOCKET> in;
+
+    std::unique_ptr<char[]> rxbuf;
+};
+
+// server side: collect every client's shuffle listening port and hand the
+// complete peer table back to each client
+void shuffleExchangePeers( SOCKET s, int client_num )
+{
+    static std::vector<SOCKADDR_INET> peers;
+    int bytes;
+
+    if( client_num == 0 )
+    {
+        peers = clientAddresses;
+    }
+
+    // make sure peers is initialized before anybody writes to it
+    pb->wait();
+
+    ShuffleListenInfo sli;
+    if ((bytes = recv(s, (char*) &sli, sizeof(ShuffleListenInfo), MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() shuffle listen info failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == sizeof(ShuffleListenInfo));
+
+    setAddressPort( peers[client_num], ntohs( sli.port ) );
+
+    // wait until every client's port is known
+    pb->wait();
+
+    const int tableSize = gtp.clients * sizeof(SOCKADDR_INET);
+    if ((bytes = send(s, (char*) &peers[0], tableSize, 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() shuffle peer table failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == tableSize);
+}
+
+struct ShuffleAccept
+{
+    SOCKET ls;
+    ShuffleMesh *mesh;
+};
+
+// accepts our peers' connections while shuffleBuildMesh makes ours, so
+// neither side waits on the other's backlog
+unsigned int __stdcall shuffleAcceptThread( void *p )
+{
+    ShuffleAccept *sa = (ShuffleAccept*) p;
+    ShuffleMesh &mesh = *sa->mesh;
+    int bytes;
+
+    for( int k = 0; k < gtp.clients - 1; ++k )
+    {
+        SOCKET ps;
+        if ((ps = accept(sa->ls, NULL, NULL)) == INVALID_SOCKET)
+        {
+            fprintf(stderr, "accept() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        int peer_num;
+        if ((bytes = recv(ps, (char*) &peer_num, sizeof(peer_num), MSG_WAITALL)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() shuffle peer id failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == sizeof(peer_num));
+        HARD_ASSERT(peer_num >= 0 && peer_num < gtp.clients);
+        HARD_ASSERT(mesh.in[peer_num] == INVALID_SOCKET);
+
+        mesh.in[peer_num] = ps;
+    }
+
+    return 0;
+}
+
+// client side: publish a listening port, get the peer table from the
+// server and connect to every other client
+void shuffleBuildMesh( SOCKET s, int client_num, ShuffleMesh &mesh )
+{
+    SOCKET ls;
+    int bytes;
+
+    // listen in the family we reach the server with, which is the one
+    // the server hands our peers
+    SOCKADDR_INET sin = {0};
+    int nlen = sizeof(sin);
+    getsockname( s, (SOCKADDR*) &sin, &nlen );
+
+    const ADDRESS_FAMILY family = sin.si_family;
+    memset( &sin, 0, sizeof(sin) );
+    sin.si_family = family;
+
+    // or on our -la address, if we have one
+    if( localAddress.si_family == family )
+    {
+        sin = localAddress;
+        setAddressPort( sin, 0 );
+    }
+
+    if ((ls = socket(sin.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+    {
+        fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    if (bind(ls, (SOCKADDR*) &sin, addressLength(sin)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "bind() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    // room for every peer at once; plain SOMAXCONN leaves it up to the OS
+    if (listen(ls, SOMAXCONN_HINT(gtp.clients)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "listen() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    nlen = sizeof(sin);
+    getsockname( ls, (SOCKADDR*) &sin, &nlen );
+
+    ShuffleListenInfo sli;
+    sli.port = htons( (u_short) addressPort( sin ) );
+
+    if ((bytes = send(s, (char*) &sli, sizeof(ShuffleListenInfo), 0)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "send() shuffle listen info failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == sizeof(ShuffleListenInfo));
+
+    std::vector<SOCKADDR_INET> peers( gtp.clients );
+    const int tableSize = gtp.clients * sizeof(SOCKADDR_INET);
+    if ((bytes = recv(s, (char*) &peers[0], tableSize, MSG_WAITALL)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "recv() shuffle peer table failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+    HARD_ASSERT(bytes == tableSize);
+
+    printf( "Connecting to %d shuffle peers...", gtp.clients - 1 );
+
+    mesh.out.assign( gtp.clients, INVALID_SOCKET );
+    mesh.in.assign( gtp.clients, INVALID_SOCKET );
+    mesh.rxbuf.reset( new char[gtp.fi_msg_size] );
+
+    ShuffleAccept sa = { ls, &mesh };
+    HANDLE acceptor = (HANDLE) _beginthreadex( NULL, 0, shuffleAcceptThread, &sa, 0, NULL );
+
+    for( int j = 0; j < gtp.clients; ++j )
+    {
+        if( j == client_num )
+            continue;
+
+        SOCKET ps;
+        if ((ps = socket(peers[j].si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+        {
+            fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        bindSourceAddress(ps);
+
+        if (connect(ps, (SOCKADDR*) &peers[j], addressLength(peers[j])) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "connect() to shuffle peer %d failed: %d\n", j, WSAGetLastError());
+            exit(-1);
+        }
+
+        // tell the peer who we are
+        if ((bytes = send(ps, (char*) &client_num, sizeof(client_num), 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "send() shuffle peer id failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == sizeof(client_num));
+
+        mesh.out[j] = ps;
+    }
+
+    WaitForSingleObject( acceptor, INFINITE );
+    CloseHandle( acceptor );
+
+    closesocket(ls);
+
+    for( int j = 0; j < gtp.clients; ++j )
+    {
+        if( j == client_num )
+            continue;
+
+        applySocketOptions( mesh.out[j] );
+        applySocketOptions( mesh.in[j] );
+        setNonBlocking( mesh.out[j] );
+        setNonBlocking( mesh.in[j] );
+    }
+
+    printf( "done!\n" );
+}
+
+// client side: one shuffle round.  Send our partition to every peer and
+// receive a partition from every peer, all at once.
+void shuffleExchange( ShuffleMesh &mesh, const char *buf )
+{
+    const int size = gtp.fi_msg_size;
+    const int peers = mesh.out.size();
+
+    std::vector<int> sent( peers, 0 );
+    std::vector<int> rcvd( peers, 0 );
+    std::vector<WSAPOLLFD> fds;
+    std::vector<int> owner;
+
+    int pending = 0;
+    for( int j = 0; j < peers; ++j )
+    {
+        if( mesh.out[j] != INVALID_SOCKET )
+            pending += 2;
+    }
+
+    while( pending > 0 )
+    {
+        fds.clear();
+        owner.clear();
+
+        for( int j = 0; j < peers; ++j )
+        {
+            if( mesh.out[j] == INVALID_SOCKET )
+                continue;
+
+            if( sent[j] < size )
+            {
+                WSAPOLLFD pfd = { mesh.out[j], POLLWRNORM, 0 };
+                fds.push_back( pfd );
+                owner.push_back( j );
+            }
+
+            if( rcvd[j] < size )
+            {
+                WSAPOLLFD pfd = { mesh.in[j], POLLRDNORM, 0 };
+                fds.push_back( pfd );
+                owner.push_back( j );
+            }
+        }
+
+        if (WSAPoll(&fds[0], fds.size(), -1) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "WSAPoll() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        for( unsigned f = 0; f < fds.size(); ++f )
+        {
+            const int j = owner[f];
+            int bytes;
+
+            if( fds[f].revents & (POLLERR | POLLHUP | POLLNVAL) )
+            {
+                fprintf(stderr, "shuffle peer %d connection failed\n", j);
+                exit(-1);
+            }
+
+            if( fds[f].revents & POLLWRNORM )
+            {
+                bytes = send(mesh.out[j], buf + sent[j], size - sent[j], 0);
+                if( bytes == SOCKET_ERROR )
+                {
+                    if( WSAGetLastError() != WSAEWOULDBLOCK )
+                    {
+                        fprintf(stderr, "send() shuffle partition failed: %d\n", WSAGetLastError());
+                        exit(-1);
+                    }
+                }
+                else if( (sent[j] += bytes) == size )
+                {
+                    --pending;
+                }
+            }
+
+            if( fds[f].revents & POLLRDNORM )
+            {
+                // partitions are discarded, so they can all share rxbuf
+                bytes = recv(mesh.in[j], mesh.rxbuf.get(), size - rcvd[j], 0);
+                if( bytes == SOCKET_ERROR )
+                {
+                    if( WSAGetLastError() != WSAEWOULDBLOCK )
+                    {
+                        fprintf(stderr, "recv() shuffle partition failed: %d\n", WSAGetLastError());
+                        exit(-1);
+                    }
+                }
+                else if( bytes == 0 )
+                {
+                    fprintf(stderr, "shuffle peer %d disconnected\n", j);
+                    exit(-1);
+                }
+                else if( (rcvd[j] += bytes) == size )
+                {
+                    --pending;
+                }
+            }
+        }
+    }
+}
+
+void shuffleCloseMesh( ShuffleMesh &mesh )
+{
+    // every partition has been consumed by now, so a plain close is graceful
+    for( unsigned j = 0; j < mesh.out.size(); ++j )
+    {
+        if( mesh.out[j] != INVALID_SOCKET )
+            closesocket( mesh.out[j] );
+
+        if( mesh.in[j] != INVALID_SOCKET )
+            closesocket( mesh.in[j] );
+    }
+
+    mesh.out.clear();
+    mesh.in.clear();
+}
+
+// per-round latency is covered by reportLatencyThroughput; this adds the
+// per-node receive rate and the aggregate (bisection) bandwidth
+void reportShuffleThroughput( double roundSeconds )
+{
+    using namespace std;
+
+    const int clients = clientResults.size();
+    const double nodeRecvMBytes =
+        gtp.fi_msg_size / 1.0e6 * (clients - 1) * gtp.iters;
+
+    double minMbps = numeric_limits<double>::max();
+    double maxMbps = 0;
+    double sumMbps = 0;
+
+    for( int c = 0; c < clients; ++c )
+    {
+        // the time this node spent in rounds, from fan-out to done
+        __int64 busy = 0;
+
+        Measurements &m = clientResults[c].measurements;
+        for( int i = 0; i < gtp.iters; ++i )
+        {
+            busy += m[i].stop - m[i].start;
+        }
+
+        double mbps = nodeRecvMBytes * 8 / (((double) busy) / freq);
+
+        minMbps = min( minMbps, mbps );
+        maxMbps = max( maxMbps, mbps );
+        sumMbps += mbps;
+    }
+
+    printf( "\tnode mbit/sec min:    %10.3f\n", minMbps );
+    printf( "\tnode mbit/sec avg:    %10.3f\n", sumMbps / clients );
+    printf( "\tnode mbit/sec max:    %10.3f\n", maxMbps );
+
+    double bisectionMBytes = nodeRecvMBytes * clients;
+    printf( "\tmbit/sec bisection:   %10.3f\n", bisectionMBytes * 8 / roundSeconds );
+}
+
+#endif // _INCAST_SHUFFLE_H
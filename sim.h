@@ -0,0 +1,547 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_SIM_H
+#define _INCAST_SIM_H
+
+#include <queue>
+#include <random>
+
+// Discrete-event simulation of a test.
+//
+// The clients' fan-ins all funnel into one drop-tail switch port in front
+// of the server.  Each client runs a simplified TCP sender: slow start and
+// congestion avoidance, fast retransmit with NewReno-style partial ACKs,
+// and a retransmission timeout bounded below by the minimum RTO.  The
+// receiver ACKs every segment.  Fan-outs and ACKs travel an uncongested
+// reverse path.  Connections are long-lived, so congestion state carries
+// over from one volley to the next, as in a real run: a volley only ends
+// once every sender has seen its last ACK, though the next one still
+// starts when the server has the last fan-in.
+//
+// Results land in clientResults just as a real run's would, so the usual
+// latency and throughput report applies.
+
+const int SIM_MSS = 1460;
+const int SIM_HEADER_BYTES = 40;
+const int SIM_INITIAL_CWND = 10;
+const __int64 SIM_NEVER = 0x7FFFFFFFFFFFFFFFLL;
+
+struct SimParameters
+{
+    int clients;
+    int buffer;             // switch port buffer, bytes
+    double link_mbps;       // every link, including the bottleneck
+    double rtt_usec;        // base round trip, without queueing
+    double min_rto_msec;
+
+    SimParameters()
+        : clients(0)
+        , buffer(128 * 1024)
+        , link_mbps(10000)
+        , rtt_usec(50)
+        , min_rto_msec(200)
+    {};
+} simParams;
+
+struct SimStats
+{
+    int drops;
+    int timeouts;
+    int fast_retransmits;
+    int max_queue;
+
+    SimStats()
+        : drops(0)
+        , timeouts(0)
+        , fast_retransmits(0)
+        , max_queue(0)
+    {};
+};
+
+class IncastSimulator
+{
+    enum EventType
+    {
+        FANOUT_ARRIVE,      // at the client
+        SWITCH_ARRIVE,      // data segment at the bottleneck port
+        SEGMENT_ARRIVE,     // data segment at the server
+        ACK_ARRIVE,         // at the client
+        RTO_EXPIRE
+    };
+
+    struct Event
+    {
+        __int64 time;       // nsec
+        __int64 order;      // breaks ties in scheduling order
+        int type;
+        int flow;
+        int volley;
+        int value;          // segment, cumulative ACK or timer generation
+
+        bool operator>( const Event &o ) const
+        {
+            return (time != o.time) ? (time > o.time) : (order > o.order);
+        }
+    };
+
+    struct Flow
+    {
+        // sender
+        int snd_una;
+        int snd_nxt;
+        double cwnd;
+        double ssthresh;
+        int dupacks;
+        int recover;        // snd_nxt when fast recovery began, -1 if not in it
+        __int64 nic_free;
+        std::vector<__int64> sent_at;   // -1 once retransmitted (Karn)
+
+        double srtt;
+        double rttvar;
+        int backoff;
+        __int64 rto_deadline;
+        bool rto_pending;
+        int rto_generation;     // a timer from an earlier one is cancelled
+
+        // receiver
+        std::vector<char> received;
+        int rcv_nxt;
+
+        __int64 delay;
+        __int64 done;
+        SimStats stats;
+    };
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    std::vector<Flow> flows_;
+    __int64 order_;
+    __int64 now_;
+    int volley_;
+    int segments_;
+    int pending_;           // flows whose fan-in hasn't fully arrived
+
+    __int64 link_free_;     // when the bottleneck finishes its queue
+    double ns_per_byte_;
+    __int64 one_way_;
+    __int64 min_rto_;
+
+    std::mt19937 rng_;
+
+    void schedule( __int64 time, int type, int flow, int value )
+    {
+        Event e = { time, order_++, type, flow, volley_, value };
+        events_.push( e );
+    }
+
+    int segmentBytes( int seq ) const
+    {
+        int payload = std::min( SIM_MSS, gtp.fi_msg_size - seq * SIM_MSS );
+        return payload + SIM_HEADER_BYTES;
+    }
+
+    __int64 txTime( int bytes ) const
+    {
+        return (__int64) (bytes * ns_per_byte_);
+    }
+
+    __int64 rto( const Flow &f ) const
+    {
+        __int64 r = (f.srtt > 0) ? (__int64) (f.srtt + 4 * f.rttvar) : 3 * 2 * one_way_;
+        return std::max( r, min_rto_ ) * f.backoff;
+    }
+
+    void armRto( int i )
+    {
+        Flow &f = flows_[i];
+        f.rto_deadline = now_ + rto( f );
+
+        // keep at most one timer per flow in the queue; it re-arms
+        // itself if the deadline moved out
+        if( !f.rto_pending )
+        {
+            f.rto_pending = true;
+            schedule( f.rto_deadline, RTO_EXPIRE, i, f.rto_generation );
+        }
+    }
+
+    void cancelRto( int i )
+    {
+        Flow &f = flows_[i];
+        f.rto_deadline = SIM_NEVER;
+        f.rto_pending = false;
+        f.rto_generation++;
+    }
+
+    void transmit( int i, int seq )
+    {
+        Flow &f = flows_[i];
+        const int bytes = segmentBytes( seq );
+
+        f.nic_free = std::max( now_, f.nic_free ) + txTime( bytes );
+        f.sent_at[seq] = (f.sent_at[seq] == SIM_NEVER) ? f.nic_free : -1;
+
+        schedule( f.nic_free, SWITCH_ARRIVE, i, seq );
+    }
+
+    void trySend( int i )
+    {
+        Flow &f = flows_[i];
+
+        while( (f.snd_nxt < segments_) && (f.snd_nxt - f.snd_una < (int) f.cwnd) )
+        {
+            transmit( i, f.snd_nxt++ );
+        }
+    }
+
+    void onSwitchArrive( const Event &e )
+    {
+        const int bytes = segmentBytes( e.value );
+
+        // whatever the port hasn't sent yet is still in its buffer
+        const int queued = (int) (std::max<__int64>( 0, link_free_ - now_ ) / ns_per_byte_);
+
+        if( queued + bytes > simParams.buffer )
+        {
+            flows_[e.flow].stats.drops++;
+            return;
+        }
+
+        flows_[e.flow].stats.max_queue = std::max( flows_[e.flow].stats.max_queue, queued + bytes );
+
+        link_free_ = std::max( now_, link_free_ ) + txTime( bytes );
+        schedule( link_free_ + one_way_, SEGMENT_ARRIVE, e.flow, e.value );
+    }
+
+    void onSegmentArrive( const Event &e )
+    {
+        Flow &f = flows_[e.flow];
+
+        f.received[e.value] = 1;
+        while( (f.rcv_nxt < segments_) && f.received[f.rcv_nxt] )
+        {
+            ++f.rcv_nxt;
+        }
+
+        if( (f.rcv_nxt == segments_) && (f.done == SIM_NEVER) )
+        {
+            f.done = now_;
+            --pending_;
+        }
+
+        schedule( now_ + one_way_, ACK_ARRIVE, e.flow, f.rcv_nxt );
+    }
+
+    void onAckArrive( const Event &e )
+    {
+        Flow &f = flows_[e.flow];
+        const int ack = e.value;
+
+        if( ack > f.snd_una )
+        {
+            // RTT sample from the newest segment this ACK covers
+            __int64 sent = f.sent_at[ack - 1];
+            if( sent >= 0 && sent != SIM_NEVER )
+            {
+                double sample = (double) (now_ - sent);
+                if( f.srtt == 0 )
+                {
+                    f.srtt = sample;
+                    f.rttvar = sample / 2;
+                }
+                else
+                {
+                    f.rttvar = 0.75 * f.rttvar + 0.25 * fabs( f.srtt - sample );
+                    f.srtt = 0.875 * f.srtt + 0.125 * sample;
+                }
+            }
+
+            const int acked = ack - f.snd_una;
+            f.snd_una = ack;
+            f.snd_nxt = std::max( f.snd_nxt, f.snd_una );
+            f.dupacks = 0;
+            f.backoff = 1;
+
+            if( f.recover >= 0 )
+            {
+                if( ack >= f.recover )
+                {
+                    f.cwnd = f.ssthresh;
+                    f.recover = -1;
+                }
+                else
+                {
+                    // partial ACK, the next hole was lost too
+                    transmit( e.flow, f.snd_una );
+                }
+            }
+            else if( f.cwnd < f.ssthresh )
+            {
+                f.cwnd += acked;
+            }
+            else
+            {
+                f.cwnd += acked / f.cwnd;
+            }
+
+            if( f.snd_una == segments_ )
+                f.rto_deadline = SIM_NEVER;
+            else
+                armRto( e.flow );
+        }
+        else if( (ack == f.snd_una) && (f.snd_una < segments_) )
+        {
+            if( (++f.dupacks == 3) && (f.recover < 0) )
+            {
+                f.stats.fast_retransmits++;
+                f.ssthresh = std::max( f.cwnd / 2, 2.0 );
+                f.cwnd = f.ssthresh;
+                f.recover = f.snd_nxt;
+                transmit( e.flow, f.snd_una );
+                armRto( e.flow );
+            }
+        }
+
+        trySend( e.flow );
+    }
+
+    void onRtoExpire( const Event &e )
+    {
+        Flow &f = flows_[e.flow];
+        if( e.value != f.rto_generation )
+            return;
+
+        f.rto_pending = false;
+
+        if( f.rto_deadline == SIM_NEVER )
+            return;
+
+        if( f.rto_deadline > now_ )
+        {
+            f.rto_pending = true;
+            schedule( f.rto_deadline, RTO_EXPIRE, e.flow, f.rto_generation );
+            return;
+        }
+
+        // go back N from the first unacknowledged segment
+        f.stats.timeouts++;
+        f.ssthresh = std::max( f.cwnd / 2, 2.0 );
+        f.cwnd = 1;
+        f.snd_nxt = f.snd_una;
+        f.recover = -1;
+        f.dupacks = 0;
+        f.backoff *= 2;
+
+        trySend( e.flow );
+        armRto( e.flow );
+    }
+
+    void step()
+    {
+        Event e = events_.top();
+        events_.pop();
+
+        // whatever is left of an earlier volley is stale
+        if( e.volley != volley_ )
+            return;
+
+        now_ = std::max( now_, e.time );
+
+        switch( e.type )
+        {
+            case FANOUT_ARRIVE:     trySend( e.flow ); armRto( e.flow ); break;
+            case SWITCH_ARRIVE:     onSwitchArrive( e ); break;
+            case SEGMENT_ARRIVE:    onSegmentArrive( e ); break;
+            case ACK_ARRIVE:        onAckArrive( e ); break;
+            case RTO_EXPIRE:        onRtoExpire( e ); break;
+        }
+    }
+
+    bool quiescent() const
+    {
+        for( auto &f : flows_ )
+        {
+            if( f.snd_una < segments_ )
+                return false;
+        }
+
+        return true;
+    }
+
+    // start a volley at now_ and run it until every fan-in has arrived,
+    // then until every sender has its last ACK; returns with now_ at the
+    // last arrival, where the next volley starts
+    void runVolley()
+    {
+        const __int64 foTime = txTime( gtp.fo_msg_size + SIM_HEADER_BYTES );
+
+        for( int i = 0; i < simParams.clients; ++i )
+        {
+            Flow &f = flows_[i];
+
+            f.snd_una = f.snd_nxt = f.rcv_nxt = 0;
+            f.dupacks = 0;
+            f.recover = -1;
+            f.backoff = 1;
+            f.sent_at.assign( segments_, SIM_NEVER );
+            f.received.assign( segments_, 0 );
+            f.done = SIM_NEVER;
+            cancelRto( i );
+
+            double target_delay = 0;
+            if( gtp.delay_method == RANDOM_JITTER )
+            {
+                target_delay = gtp.delay * std::uniform_real_distribution<double>( 0, 1 )( rng_ );
+            }
+            else if( gtp.delay_method == UNIFORM_SCHED )
+            {
+                target_delay = gtp.delay * ((double) i / simParams.clients);
+            }
+            f.delay = (__int64) (target_delay * 1.0e6);
+
+            schedule( now_ + f.delay + foTime + one_way_, FANOUT_ARRIVE, i, 0 );
+        }
+
+        pending_ = simParams.clients;
+
+        while( pending_ > 0 )
+        {
+            step();
+        }
+
+        // the last ACKs grow cwnd and free the senders before the next
+        // fan-out reaches them, so take them in without moving the start
+        const __int64 end = now_;
+
+        while( !quiescent() )
+        {
+            step();
+        }
+
+        now_ = end;
+    }
+
+    public:
+
+    IncastSimulator()
+        : order_(0)
+        , now_(0)
+        , volley_(0)
+        , link_free_(0)
+        , rng_(1)
+    {
+        segments_ = (gtp.fi_msg_size + SIM_MSS - 1) / SIM_MSS;
+        ns_per_byte_ = 8.0e3 / simParams.link_mbps;
+        one_way_ = (__int64) (simParams.rtt_usec * 1000 / 2);
+        min_rto_ = (__int64) (simParams.min_rto_msec * 1.0e6);
+
+        flows_.resize( simParams.clients );
+        for( int i = 0; i < simParams.clients; ++i )
+        {
+            Flow &f = flows_[i];
+            f.cwnd = SIM_INITIAL_CWND;
+            f.ssthresh = 1.0e9;
+            f.nic_free = 0;
+            f.srtt = f.rttvar = 0;
+            f.rto_deadline = SIM_NEVER;
+            f.rto_pending = false;
+            f.rto_generation = 0;
+        }
+    }
+
+    void run()
+    {
+        const int volleys = WARMUP_ITERS + gtp.iters;
+        __int64 firstStart = 0;
+
+        for( volley_ = 0; volley_ < volleys; ++volley_ )
+        {
+            const int i = volley_ - WARMUP_ITERS;
+
+            if( i == 0 )
+                firstStart = now_;
+
+            if( gtp.rate_limited && i > 0 )
+            {
+                now_ = std::max( now_, firstStart + (__int64) (1.0e9 * i / gtp.target_rate) );
+            }
+
+            const __int64 start = now_;
+
+            runVolley();
+
+            if( i < 0 )
+                continue;
+
+            for( int c = 0; c < simParams.clients; ++c )
+            {
+                Measurement m;
+                m.start = simToQpc( start );
+                m.release = m.start;
+                m.stop = simToQpc( flows_[c].done );
+                m.actual_delay = simToQpc( flows_[c].delay );
+                clientResults[c].measurements.push_back( m );
+            }
+        }
+    }
+
+    static __int64 simToQpc( __int64 ns )
+    {
+        return (__int64) (ns * ((double) freq / 1.0e9));
+    }
+
+    SimStats stats( int flow ) const
+    {
+        return flows_[flow].stats;
+    }
+};
+
+void reportSimulation( const IncastSimulator &sim, double wallSeconds )
+{
+    SimStats total;
+
+    for( int c = 0; c < simParams.clients; ++c )
+    {
+        SimStats s = sim.stats( c );
+        total.drops += s.drops;
+        total.timeouts += s.timeouts;
+        total.fast_retransmits += s.fast_retransmits;
+        total.max_queue = std::max( total.max_queue, s.max_queue );
+    }
+
+    printf( "\nSimulated network:\n" );
+    printf( "\tlink mbit/sec:        %10.3f\n", simParams.link_mbps );
+    printf( "\tport buffer bytes:    %10d\n", simParams.buffer );
+    printf( "\tbase rtt usec:        %10.3f\n", simParams.rtt_usec );
+    printf( "\tmin rto msec:         %10.3f\n", simParams.min_rto_msec );
+    printf( "\tmax queue bytes:      %10d\n", total.max_queue );
+    printf( "\tdrops:                %10d\n", total.drops );
+    printf( "\ttimeouts:             %10d\n", total.timeouts );
+    printf( "\tfast retransmits:     %10d\n", total.fast_retransmits );
+    printf( "\tvolleys/sec simulated:%10.0f\n", (WARMUP_ITERS + gtp.iters) / wallSeconds );
+}
+
+#endif // _INCAST_SIM_H
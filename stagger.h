@@ -0,0 +1,195 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_STAGGER_H
+#define _INCAST_STAGGER_H
+
+// Staggered fan-out.  Normally every serverThread sends its fan-out as
+// soon as the barrier lets it go.  With -fb B USEC the clients go out in
+// batches of B, each batch USEC after the one before it; with -fw K at
+// most K clients are answering at once, and the next one is sent its
+// fan-out as each fan-in arrives.  Clients go in client number order.
+//
+// The scheduling wait is inside the measurement, like -j and -s, so the
+// volley time is from the first fan-out to the last fan-in.  The test
+// runs once with everyone released at once and then with the policy.
+// -ft tries batches and windows of n/2, n/4 ... 1 clients instead, with
+// the gap set from the first run's median, and picks the one with the
+// lowest median volley time.
+
+struct StaggerSetting
+{
+    StaggerPolicy policy;
+    int size;           // batch size or window
+    int gap_usec;
+};
+
+struct StaggerState
+{
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE answered;
+    __int64 finished;               // fan-ins received, all volleys
+
+    std::vector<StaggerSetting> runs;
+
+    StaggerState()
+        : finished(0)
+    {
+        InitializeCriticalSection( &lock );
+        InitializeConditionVariable( &answered );
+    }
+} stagger;
+
+std::string staggerDescription( const StaggerSetting &s )
+{
+    char buf[64];
+
+    switch( s.policy )
+    {
+        case STAGGER_BATCH:
+            sprintf_s( buf, sizeof(buf), "batch %d/%dus", s.size, s.gap_usec );
+            break;
+
+        case STAGGER_WINDOW:
+            sprintf_s( buf, sizeof(buf), "window %d", s.size );
+            break;
+
+        default:
+            sprintf_s( buf, sizeof(buf), "all" );
+    }
+
+    return buf;
+}
+
+void staggerApply( const StaggerSetting &s )
+{
+    gtp.stagger = s.policy;
+    gtp.stagger_size = s.size;
+    gtp.stagger_gap_usec = s.gap_usec;
+}
+
+// runTest, before the serverThreads start
+void staggerReset()
+{
+    stagger.finished = 0;
+}
+
+// serverThread, after the barrier and before the fan-out
+void staggerAdmit( int client_num, int iter, __int64 start )
+{
+    if( gtp.stagger == STAGGER_BATCH )
+    {
+        const __int64 release = start +
+            (__int64) (client_num / gtp.stagger_size) * gtp.stagger_gap_usec * freq / 1000000;
+
+        while( qpc() < release )
+        {
+            Sleep(0);
+        }
+    }
+    else if( gtp.stagger == STAGGER_WINDOW )
+    {
+        // the volleys before this one have all been answered
+        const __int64 base = (__int64) iter * incastClients();
+
+        EnterCriticalSection( &stagger.lock );
+        while( client_num >= gtp.stagger_size + (stagger.finished - base) )
+        {
+            SleepConditionVariableCS( &stagger.answered, &stagger.lock, INFINITE );
+        }
+        LeaveCriticalSection( &stagger.lock );
+    }
+}
+
+// serverThread, once the fan-in is in
+void staggerDone()
+{
+    if( gtp.stagger != STAGGER_WINDOW )
+        return;
+
+    EnterCriticalSection( &stagger.lock );
+    stagger.finished++;
+    LeaveCriticalSection( &stagger.lock );
+
+    WakeAllConditionVariable( &stagger.answered );
+}
+
+// -ft, after the run with everyone at once: batches and windows of
+// halving size, a batch's gap being its share of the median volley
+void staggerCandidates( int clients, const TestSummary &all )
+{
+    for( int b = clients / 2; b >= 1; b /= 2 )
+    {
+        StaggerSetting s = { STAGGER_BATCH, b, std::max( 1, (int) (all.median_usec * b / clients) ) };
+        stagger.runs.push_back( s );
+    }
+
+    for( int k = clients / 2; k >= 1; k /= 2 )
+    {
+        StaggerSetting s = { STAGGER_WINDOW, k, 0 };
+        stagger.runs.push_back( s );
+    }
+}
+
+void reportStagger()
+{
+    if( gtp.stagger == STAGGER_NONE )
+        return;
+
+    StaggerSetting s = { gtp.stagger, gtp.stagger_size, gtp.stagger_gap_usec };
+
+    printf( "\nStaggered fan-out:\n" );
+    printf( "\tpolicy:               %10s\n", staggerDescription( s ).c_str() );
+}
+
+void reportStaggerComparison( const std::vector<TestSummary> &runs )
+{
+    printf( "\nStaggered fan-out comparison:\n" );
+    printf( "\t%-16s %12s %12s %12s %12s %12s %12s\n",
+        "policy", "median usec", "99th usec", "max usec", "99th vs all", "iter/sec", "retransmits" );
+
+    unsigned best = 0;
+
+    for( unsigned r = 0; r < runs.size(); ++r )
+    {
+        const TestSummary &t = runs[r];
+        printf( "\t%-16s %12.3f %12.3f %12.3f %11.1f%% %12.3f %12d\n",
+            staggerDescription( stagger.runs[r] ).c_str(),
+            t.median_usec, t.p99_usec, t.max_usec,
+            (t.p99_usec / runs[0].p99_usec - 1) * 100,
+            t.iters_per_sec, t.retransmits );
+
+        if( t.median_usec < runs[best].median_usec )
+            best = r;
+    }
+
+    if( gtp.stagger_tune )
+    {
+        printf( "\tlowest median:        %10s\n", staggerDescription( stagger.runs[best] ).c_str() );
+    }
+}
+
+#endif // _INCAST_STAGGER_H
@@ -0,0 +1,379 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_STRIPE_H
+#define _INCAST_STRIPE_H
+
+// Striped fan-in.  With -st NUM each client answers over NUM connections
+// instead of one, the way a storage client striping a response would,
+// so the server sees NUM times the flows.  The fan-out still goes down
+// the test connection, which is also stripe 0; once a client has its
+// parameters it opens the other stripes to the stripe port and names
+// itself with a StripeHeader.  Fan-in k is the kth of NUM near-equal
+// pieces of the message, and a volley is only in once every stripe is.
+//
+// The client posts every stripe at once as an overlapped send, and the
+// server polls a client's stripes and notes when each one completes, so
+// the report shows how unevenly the network delivers the stripes of a
+// volley rather than the order they were sent in.
+//
+// The stripe port is the server's, so clients can't reach it through a
+// relay; -st is refused with -lq, and a client pointed at a -relay fails
+// to connect its stripes.
+
+const unsigned STRIPE_PORT_OFFSET = 3000;
+
+struct StripeHeader
+{
+    int client_num;
+    int stripe;
+};
+
+struct StripeState
+{
+    SOCKET listener;
+    HANDLE acceptor;
+    HANDLE connected;       // manual reset, once every stripe is in
+    std::vector<std::vector<SOCKET>> sockets;   // [client][stripe]
+    volatile bool stopping;
+} stripes;
+
+// a client's stripes, with one overlapped send in flight on each
+struct ClientStripes
+{
+    std::vector<SOCKET> sockets;
+    std::vector<WSAOVERLAPPED> sends;
+};
+
+unsigned stripePort()
+{
+    return basePort + STRIPE_PORT_OFFSET;
+}
+
+void stripePiece( int size, int stripe, int &offset, int &len )
+{
+    const int base = size / gtp.stripes;
+    const int extra = size % gtp.stripes;
+
+    offset = stripe * base + std::min( stripe, extra );
+    len = base + ((stripe < extra) ? 1 : 0);
+}
+
+unsigned int __stdcall stripeAcceptThread( void * )
+{
+    int remaining = incastClients() * (gtp.stripes - 1);
+    int bytes;
+
+    while( remaining > 0 )
+    {
+        SOCKET cs;
+        if ((cs = accept(stripes.listener, NULL, NULL)) == INVALID_SOCKET)
+        {
+            // stripeStop closes the listener if a run ends early
+            if( stripes.stopping )
+                break;
+
+            fprintf(stderr, "accept() stripe failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        applySocketOptions(cs);
+
+        StripeHeader h;
+        if ((bytes = recv(cs, (char*) &h, sizeof(h), MSG_WAITALL)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "recv() stripe header failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == sizeof(h));
+        HARD_ASSERT(h.client_num >= 0 && h.client_num < (int) stripes.sockets.size());
+        HARD_ASSERT(h.stripe > 0 && h.stripe < gtp.stripes);
+
+        stripes.sockets[h.client_num][h.stripe] = cs;
+        remaining--;
+    }
+
+    SetEvent( stripes.connected );
+    return 0;
+}
+
+// runTest, before the serverThreads start
+void stripeStart()
+{
+    stripes.stopping = false;
+    stripes.listener = createAuxListener( stripePort() );
+    stripes.connected = CreateEvent( NULL, TRUE, FALSE, NULL );
+    stripes.sockets.assign( incastClients(), std::vector<SOCKET>( gtp.stripes, INVALID_SOCKET ) );
+    stripes.acceptor = (HANDLE) _beginthreadex( NULL, 0, stripeAcceptThread, NULL, 0, NULL );
+}
+
+void stripeStop()
+{
+    stripes.stopping = true;
+    closesocket( stripes.listener );
+
+    WaitForSingleObject( stripes.acceptor, INFINITE );
+    CloseHandle( stripes.acceptor );
+    CloseHandle( stripes.connected );
+
+    // stripe 0 is the test connection, which runTest closes
+    for( auto &client : stripes.sockets )
+    {
+        for( unsigned k = 1; k < client.size(); ++k )
+        {
+            if( client[k] != INVALID_SOCKET )
+                closesocket( client[k] );
+        }
+    }
+
+    stripes.sockets.clear();
+}
+
+// serverThread, before warm-up
+void stripeWaitConnected( SOCKET s, int client_num, TestResult &tr )
+{
+    WaitForSingleObject( stripes.connected, INFINITE );
+    stripes.sockets[client_num][0] = s;
+
+    tr.stripe_last.assign( gtp.stripes, 0 );
+    tr.stripe_spread.reserve( gtp.iters );
+}
+
+// serverThread, in place of receiving the fan-in on the test connection;
+// with tr, records how far apart the stripes completed
+void stripeRecvFanIn( int client_num, char *buf, int size, TestResult *tr )
+{
+    const std::vector<SOCKET> &socks = stripes.sockets[client_num];
+
+    std::vector<int> rcvd( gtp.stripes, 0 );
+    std::vector<__int64> done( gtp.stripes, 0 );
+    int pending = gtp.stripes;
+
+    std::vector<WSAPOLLFD> fds;
+    std::vector<int> owner;
+
+    while( pending > 0 )
+    {
+        fds.clear();
+        owner.clear();
+
+        for( int k = 0; k < gtp.stripes; ++k )
+        {
+            int offset, len;
+            stripePiece( size, k, offset, len );
+
+            if( rcvd[k] < len )
+            {
+                WSAPOLLFD pfd = { socks[k], POLLRDNORM, 0 };
+                fds.push_back( pfd );
+                owner.push_back( k );
+            }
+        }
+
+        if (WSAPoll(&fds[0], fds.size(), -1) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "WSAPoll() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        for( unsigned f = 0; f < fds.size(); ++f )
+        {
+            const int k = owner[f];
+
+            if( fds[f].revents & (POLLERR | POLLNVAL) )
+            {
+                fprintf(stderr, "stripe %d of client %d failed\n", k, client_num);
+                exit(-1);
+            }
+
+            // a client that has hung up may still have data for us
+            if( fds[f].revents & (POLLRDNORM | POLLHUP) )
+            {
+                int offset, len;
+                stripePiece( size, k, offset, len );
+
+                int bytes = recv(socks[k], buf + offset + rcvd[k], len - rcvd[k], 0);
+                if( (bytes == SOCKET_ERROR) || (bytes == 0) )
+                {
+                    fprintf(stderr, "recv() stripe fan-in failed: %d\n", WSAGetLastError());
+                    exit(-1);
+                }
+
+                if( (rcvd[k] += bytes) == len )
+                {
+                    done[k] = qpc();
+                    --pending;
+                }
+            }
+        }
+    }
+
+    if( tr )
+    {
+        auto first = std::min_element( done.begin(), done.end() );
+        auto last = std::max_element( done.begin(), done.end() );
+
+        tr->stripe_spread.push_back( *last - *first );
+        tr->stripe_last[last - done.begin()]++;
+    }
+}
+
+// clientMain, once it has its parameters; stripe 0 is s
+void clientStripeConnect( SOCKADDR_INET server, SOCKET s, int client_num, ClientStripes &cs )
+{
+    int bytes;
+
+    setAddressPort( server, stripePort() );
+
+    cs.sockets.assign( 1, s );
+    cs.sends.assign( gtp.stripes, WSAOVERLAPPED() );
+
+    for( auto &ov : cs.sends )
+    {
+        if ((ov.hEvent = WSACreateEvent()) == WSA_INVALID_EVENT)
+        {
+            fprintf(stderr, "WSACreateEvent() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+    }
+
+    for( int k = 1; k < gtp.stripes; ++k )
+    {
+        SOCKET ss;
+        if ((ss = socket(server.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+        {
+            fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        applySocketOptions(ss);
+        bindSourceAddress(ss);
+
+        if (connect(ss, (SOCKADDR*) &server, addressLength(server)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "connect() stripe failed, is there a relay in the way? %d\n", WSAGetLastError());
+            exit(-1);
+        }
+
+        StripeHeader h = { client_num, k };
+        if ((bytes = send(ss, (char*) &h, sizeof(h), 0)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "send() stripe header failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(bytes == sizeof(h));
+
+        cs.sockets.push_back( ss );
+    }
+}
+
+// clientMain, in place of sending the fan-in on the test connection;
+// every stripe is in flight before we wait for any of them
+void clientStripeFanIn( ClientStripes &cs, const char *buf, int size )
+{
+    for( int k = 0; k < gtp.stripes; ++k )
+    {
+        int offset, len;
+        stripePiece( size, k, offset, len );
+
+        WSAOVERLAPPED &ov = cs.sends[k];
+        const WSAEVENT event = ov.hEvent;
+        memset( &ov, 0, sizeof(ov) );
+        ov.hEvent = event;
+
+        WSABUF wb = { (ULONG) len, (char*) buf + offset };
+        DWORD sent;
+        if ((WSASend(cs.sockets[k], &wb, 1, &sent, 0, &ov, NULL) == SOCKET_ERROR) &&
+            (WSAGetLastError() != WSA_IO_PENDING))
+        {
+            fprintf(stderr, "WSASend() stripe fan-in failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+    }
+
+    for( int k = 0; k < gtp.stripes; ++k )
+    {
+        int offset, len;
+        stripePiece( size, k, offset, len );
+
+        DWORD sent, flags;
+        if (!WSAGetOverlappedResult(cs.sockets[k], &cs.sends[k], &sent, TRUE, &flags))
+        {
+            fprintf(stderr, "WSASend() stripe fan-in failed: %d\n", WSAGetLastError());
+            exit(-1);
+        }
+        HARD_ASSERT(sent == (DWORD) len);
+    }
+}
+
+void clientStripeClose( ClientStripes &cs )
+{
+    for( unsigned k = 1; k < cs.sockets.size(); ++k )
+        closesocket( cs.sockets[k] );
+
+    for( auto &ov : cs.sends )
+        WSACloseEvent( ov.hEvent );
+
+    cs.sockets.clear();
+    cs.sends.clear();
+}
+
+void reportStripes()
+{
+    if( gtp.stripes <= 1 )
+        return;
+
+    std::vector<__int64> spread;
+    std::vector<__int64> last( gtp.stripes, 0 );
+
+    for( auto &tr : clientResults )
+    {
+        spread.insert( spread.end(), tr.stripe_spread.begin(), tr.stripe_spread.end() );
+
+        for( int k = 0; k < gtp.stripes; ++k )
+            last[k] += tr.stripe_last[k];
+    }
+
+    if( spread.empty() )
+        return;
+
+    std::sort( spread.begin(), spread.end() );
+    const size_t n = spread.size();
+
+    printf( "\nStriped fan-in:\n" );
+    printf( "\tstreams per client:   %10d\n", gtp.stripes );
+    printf( "\tconnections:          %10d\n", gtp.stripes * (int) clientResults.size() );
+    printf( "\tspread median usec:   %10.3f\n", spread[n / 2] * 1.0e6 / freq );
+    printf( "\tspread 99th usec:     %10.3f\n", spread[std::min( n - 1, n * 99 / 100 )] * 1.0e6 / freq );
+    printf( "\tspread max usec:      %10.3f\n", spread[n - 1] * 1.0e6 / freq );
+
+    for( int k = 0; k < gtp.stripes; ++k )
+    {
+        printf( "\tstripe %2d last:       %9.1f%%\n", k, last[k] * 100.0 / n );
+    }
+}
+
+#endif // _INCAST_STRIPE_H
@@ -26,6 +26,50 @@
 
 #ifndef _INCAST_TCPSTATS_H
 #define _INCAST_TCPSTATS_H
+
+// GetTcpStatistics is IPv4 only; add IPv6 to the counters we use
+void getTcpStatistics( MIB_TCPSTATS *stats )
+{
+    MIB_TCPSTATS v6;
+
+    GetTcpStatisticsEx( stats, AF_INET );
+
+    if( GetTcpStatisticsEx( &v6, AF_INET6 ) == NO_ERROR )
+    {
+        stats->dwActiveOpens += v6.dwActiveOpens;
+        stats->dwPassiveOpens += v6.dwPassiveOpens;
+        stats->dwAttemptFails += v6.dwAttemptFails;
+        stats->dwEstabResets += v6.dwEstabResets;
+        stats->dwInSegs += v6.dwInSegs;
+        stats->dwOutSegs += v6.dwOutSegs;
+        stats->dwRetransSegs += v6.dwRetransSegs;
+        stats->dwInErrs += v6.dwInErrs;
+        stats->dwOutRsts += v6.dwOutRsts;
+    }
+}
+
+// clients on the same host see the same system-wide count, so take
+// each host's once
+int clientRetransmits()
+{
+    std::map<std::string, int> hosts;
+
+    for( auto &tr : clientResults )
+    {
+        auto h = hosts.insert( std::make_pair( std::string( tr.crd.host ), std::numeric_limits<int>::min() ) ).first;
+        h->second = std::max( h->second, tr.crd.retransmits );
+    }
+
+    int clientRetransmits = 0;
+
+    for( auto &h : hosts )
+    {
+        clientRetransmits += h.second;
+    }
+
+    return clientRetransmits;
+}
+
 void reportTcpStats()
 {
     using namespace std;
@@ -33,10 +77,6 @@ void reportTcpStats()
     // ISSUE-REVIEW
     // This is a system-wide statistic for all TCP connections.  Can I get a
     // per-connection equivalent with GetPerTcpConnectionEStats or another API?
-    //
-    // ISSUE-REVIEW
-    // I aggregate this system-wide value per-ip.  I am conflating ip with system.
-    // This is broken on multi-homed machines.
 
     int serverRetransmits =
         tcpStatsAfter.dwRetransSegs - tcpStatsBefore.dwRetransSegs;
@@ -45,31 +85,10 @@ void reportTcpStats()
     printf( "Retransmits (system-wide):\n" );
     printf( "\tserver:                      %3d\n", serverRetransmits );
   
-    int clientRetransmits = 0;
-
-    ClientAddressMap::const_iterator i;
-    for( i = clientAddressMap.begin(); i != clientAddressMap.end(); ++i )
-    {
-        int maxRetransmits = numeric_limits<int>::min();
-        int num_clients = i->second.size();
-
-        for( int j = 0; j < num_clients; ++j )
-        {
-            int client_num = i->second[j];
-            maxRetransmits = 
-                max( maxRetransmits, clientResults[client_num].crd.retransmits );
-        }
-       
-        clientRetransmits += maxRetransmits;
-
-        //printf( "\tall %3d clients from %15.15s: %d\n", 
-        //        num_clients,
-        //        i->first.c_str(),
-        //        maxRetransmits );
-    }
+    int clients = clientRetransmits();
     
-    printf( "\tclients:                     %3d\n", clientRetransmits );
-    printf( "\ttotal:                       %3d\n", clientRetransmits + serverRetransmits );
+    printf( "\tclients:                     %3d\n", clients );
+    printf( "\ttotal:                       %3d\n", clients + serverRetransmits );
 }
 
 bool enableTcpEStats()
@@ -94,7 +113,7 @@ bool enableTcpEStats()
     for( unsigned i = 0; i < tcpTable->dwNumEntries; ++i )
     {
         PMIB_TCPROW tr = &tcpTable->table[i];
-        if( ntohs((u_short) tr->dwLocalPort) == PORT )
+        if( isTestPort( ntohs((u_short) tr->dwLocalPort) ) )
         {
             TCP_ESTATS_SND_CONG_RW_v0 snd_rw;
             snd_rw.EnableCollection = 1;
@@ -146,7 +165,7 @@ void reportTcpEStats()
         TCP_ESTATS_SND_CONG_ROD_v0 snd_rod;
 
         PMIB_TCPROW tr = &tcpTable->table[i];
-        if( ntohs((u_short) tr->dwLocalPort) == PORT )
+        if( isTestPort( ntohs((u_short) tr->dwLocalPort) ) )
         {
             r = GetPerTcpConnectionEStats(
                 tr,
@@ -180,7 +199,7 @@ void reportTcpEStats()
         TCP_ESTATS_SND_CONG_ROD_v0 snd_rod;
 
         PMIB_TCPROW tr = &tcpTable->table[i];
-        if( ntohs((u_short) tr->dwLocalPort) == PORT )
+        if( isTestPort( ntohs((u_short) tr->dwLocalPort) ) )
         {
             r = GetPerTcpConnectionEStats(
                 tr,
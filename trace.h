@@ -0,0 +1,312 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_TRACE_H
+#define _INCAST_TRACE_H
+
+#include <deque>
+
+// Per-volley trace.  With -tr FILE every measured volley is appended to
+// FILE in time order as the test runs, and with -trc so is every
+// client's share of it.  ANALYZE.EXE maps the file and reads it in place.
+//
+// The file is a run header for each run the server makes, each followed
+// by blocks of up to TRACE_BLOCK_VOLLEYS volleys.  A block is stored by
+// column: its TraceBlockHeader, then one __int64 per volley for each of
+// the TRACE_COLUMNS, then with per-client columns the same again for
+// each client, client by client.  Times are qpc ticks at the run
+// header's frequency, and everything is 8-byte aligned.
+//
+// The last serverThread to reach the barrier copies the volley before
+// into the current block, and a writer thread appends full blocks
+// through a large stdio buffer, so the volleys never wait on the disk.
+
+const char TRACE_RUN_MAGIC[8] = "INCRUN2";
+const char TRACE_BLOCK_MAGIC[8] = "INCBLK2";
+
+const int TRACE_BLOCK_VOLLEYS = 1024;
+const int TRACE_BUFFER = 4 * 1024 * 1024;
+
+enum TraceColumn
+{
+    TRACE_START,        // first fan-out, or the client's
+    TRACE_STOP,         // last fan-in, or the client's
+    TRACE_DELAY,        // longest -j or -s delay, or the client's
+    TRACE_BYTES,        // fan-in bytes
+    TRACE_RELEASE,      // when the barrier released the serverThreads, after
+                        // onRelease, see release.h; the same for every client
+    TRACE_COLUMNS
+};
+
+const int TRACE_PER_CLIENT = 1;
+
+struct TraceRunHeader
+{
+    char magic[8];
+    __int64 freq;
+    int clients;
+    int flags;
+    int fo_msg_size;
+    int fi_msg_size;
+};
+
+struct TraceBlockHeader
+{
+    char magic[8];
+    int first_volley;
+    int volleys;
+};
+
+size_t traceBlockSize( const TraceRunHeader &run, int volleys )
+{
+    const int sets = (run.flags & TRACE_PER_CLIENT) ? 1 + run.clients : 1;
+    return sizeof(TraceBlockHeader) + (size_t) sets * TRACE_COLUMNS * volleys * sizeof(__int64);
+}
+
+const __int64 *traceColumn( const TraceBlockHeader *b, TraceColumn column )
+{
+    return ((const __int64 *) (b + 1)) + (size_t) column * b->volleys;
+}
+
+const __int64 *traceClientColumn( const TraceBlockHeader *b, int client, TraceColumn column )
+{
+    return traceColumn( b, column ) + (size_t) (1 + client) * TRACE_COLUMNS * b->volleys;
+}
+
+struct TraceBlock
+{
+    int first_volley;
+    int volleys;
+    std::vector<__int64> columns;   // TRACE_BLOCK_VOLLEYS per column
+};
+
+struct TraceState
+{
+    FILE *file;
+    bool per_client;
+
+    TraceRunHeader run;
+    int traced;                     // volleys copied this run
+    TraceBlock *current;
+
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE ready;
+    std::deque<TraceBlock*> full;
+    bool stopping;
+    HANDLE writer;
+
+    TraceState()
+        : file(NULL)
+        , per_client(false)
+        , current(NULL)
+    {
+        InitializeCriticalSection( &lock );
+        InitializeConditionVariable( &ready );
+    };
+} trace;
+
+bool traceOpen( const char *path )
+{
+    if( fopen_s( &trace.file, path, "wb" ) != 0 )
+        return false;
+
+    setvbuf( trace.file, NULL, _IOFBF, TRACE_BUFFER );
+    return true;
+}
+
+TraceBlock *traceNewBlock()
+{
+    TraceBlock *b = new TraceBlock;
+    b->first_volley = trace.traced;
+    b->volleys = 0;
+    b->columns.resize( (size_t) TRACE_COLUMNS * TRACE_BLOCK_VOLLEYS *
+        ((trace.run.flags & TRACE_PER_CLIENT) ? 1 + trace.run.clients : 1) );
+    return b;
+}
+
+void traceWriteBlock( const TraceBlock *b )
+{
+    TraceBlockHeader h;
+    memcpy( h.magic, TRACE_BLOCK_MAGIC, sizeof(h.magic) );
+    h.first_volley = b->first_volley;
+    h.volleys = b->volleys;
+
+    fwrite( &h, sizeof(h), 1, trace.file );
+
+    // only the filled part of each column
+    for( size_t c = 0; c < b->columns.size(); c += TRACE_BLOCK_VOLLEYS )
+    {
+        fwrite( &b->columns[c], sizeof(__int64), b->volleys, trace.file );
+    }
+}
+
+unsigned int __stdcall traceWriter( void * )
+{
+    EnterCriticalSection( &trace.lock );
+
+    while( true )
+    {
+        while( trace.full.empty() && !trace.stopping )
+        {
+            SleepConditionVariableCS( &trace.ready, &trace.lock, INFINITE );
+        }
+
+        if( trace.full.empty() )
+            break;
+
+        TraceBlock *b = trace.full.front();
+        trace.full.pop_front();
+
+        LeaveCriticalSection( &trace.lock );
+        traceWriteBlock( b );
+        delete b;
+        EnterCriticalSection( &trace.lock );
+    }
+
+    LeaveCriticalSection( &trace.lock );
+    return 0;
+}
+
+void traceQueue( TraceBlock *b )
+{
+    EnterCriticalSection( &trace.lock );
+    trace.full.push_back( b );
+    LeaveCriticalSection( &trace.lock );
+
+    WakeConditionVariable( &trace.ready );
+}
+
+// runTest, before the serverThreads start
+void traceStart()
+{
+    if( !trace.file )
+        return;
+
+    memcpy( trace.run.magic, TRACE_RUN_MAGIC, sizeof(trace.run.magic) );
+    trace.run.freq = freq;
+    trace.run.clients = incastClients();
+    trace.run.flags = trace.per_client ? TRACE_PER_CLIENT : 0;
+    trace.run.fo_msg_size = gtp.fo_msg_size;
+    trace.run.fi_msg_size = gtp.fi_msg_size;
+
+    fwrite( &trace.run, sizeof(trace.run), 1, trace.file );
+
+    trace.traced = 0;
+    trace.current = traceNewBlock();
+    trace.stopping = false;
+    trace.writer = (HANDLE) _beginthreadex( NULL, 0, traceWriter, NULL, 0, NULL );
+}
+
+// barrier callback: copy the volleys every serverThread has finished
+void traceVolley()
+{
+    if( !trace.file )
+        return;
+
+    const int clients = trace.run.clients;
+    const __int64 bytes = gtp.shuffle ? SHUFFLE_DONE_MSG_SIZE : gtp.fi_msg_size;
+
+    while( true )
+    {
+        for( int c = 0; c < clients; ++c )
+        {
+            if( (int) clientResults[c].measurements.size() <= trace.traced )
+                return;
+        }
+
+        TraceBlock *b = trace.current;
+        const int v = b->volleys;
+        __int64 *col = b->columns.data();
+
+        __int64 start = std::numeric_limits<__int64>::max();
+        __int64 stop = std::numeric_limits<__int64>::min();
+        __int64 delay = 0;
+
+        for( int c = 0; c < clients; ++c )
+        {
+            const Measurement &m = clientResults[c].measurements[trace.traced];
+
+            start = std::min( start, m.start );
+            stop = std::max( stop, m.stop );
+            delay = std::max( delay, m.actual_delay );
+
+            if( trace.per_client )
+            {
+                __int64 *cc = col + (size_t) (1 + c) * TRACE_COLUMNS * TRACE_BLOCK_VOLLEYS;
+                cc[TRACE_START * TRACE_BLOCK_VOLLEYS + v] = m.start;
+                cc[TRACE_STOP * TRACE_BLOCK_VOLLEYS + v] = m.stop;
+                cc[TRACE_DELAY * TRACE_BLOCK_VOLLEYS + v] = m.actual_delay;
+                cc[TRACE_BYTES * TRACE_BLOCK_VOLLEYS + v] = bytes;
+                cc[TRACE_RELEASE * TRACE_BLOCK_VOLLEYS + v] = m.release;
+            }
+        }
+
+        col[TRACE_START * TRACE_BLOCK_VOLLEYS + v] = start;
+        col[TRACE_STOP * TRACE_BLOCK_VOLLEYS + v] = stop;
+        col[TRACE_DELAY * TRACE_BLOCK_VOLLEYS + v] = delay;
+        col[TRACE_BYTES * TRACE_BLOCK_VOLLEYS + v] = bytes * clients;
+        col[TRACE_RELEASE * TRACE_BLOCK_VOLLEYS + v] = clientResults[0].measurements[trace.traced].release;
+
+        b->volleys++;
+        trace.traced++;
+
+        if( b->volleys == TRACE_BLOCK_VOLLEYS )
+        {
+            traceQueue( b );
+            trace.current = traceNewBlock();
+        }
+    }
+}
+
+// runTest, once the serverThreads are done: the volleys after the last
+// barrier, then wait for the writer
+void traceStop()
+{
+    if( !trace.file )
+        return;
+
+    traceVolley();
+
+    if( trace.current->volleys > 0 )
+        traceQueue( trace.current );
+    else
+        delete trace.current;
+
+    trace.current = NULL;
+
+    EnterCriticalSection( &trace.lock );
+    trace.stopping = true;
+    LeaveCriticalSection( &trace.lock );
+
+    WakeConditionVariable( &trace.ready );
+
+    WaitForSingleObject( trace.writer, INFINITE );
+    CloseHandle( trace.writer );
+
+    fflush( trace.file );
+}
+
+#endif // _INCAST_TRACE_H
@@ -96,11 +96,161 @@ __int64 mySleep( const double target_msec )
     return actual;
 }
 
+__int64 filetime_to_usec( const FILETIME &ft )
+{
+    ULARGE_INTEGER u;
+    u.LowPart = ft.dwLowDateTime;
+    u.HighPart = ft.dwHighDateTime;
+    return u.QuadPart / 10;
+}
+
+CpuTimes getCpuTimes()
+{
+    FILETIME creation, exited, kernel, user;
+    GetProcessTimes( GetCurrentProcess(), &creation, &exited, &kernel, &user );
+
+    CpuTimes t;
+    t.user = filetime_to_usec( user );
+    t.kernel = filetime_to_usec( kernel );
+    t.wall = (__int64) (qpc() * 1.0e6 / freq);
+    return t;
+}
+
+CpuTimes operator-( const CpuTimes &a, const CpuTimes &b )
+{
+    CpuTimes t;
+    t.user = a.user - b.user;
+    t.kernel = a.kernel - b.kernel;
+    t.wall = a.wall - b.wall;
+    return t;
+}
+
 void setHighPriority()
 {
     SetPriorityClass( GetCurrentProcess(), HIGH_PRIORITY_CLASS );
 }
 
+// WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles
+void waitForThreads( const std::vector<HANDLE> &threads )
+{
+    for( unsigned i = 0; i < threads.size(); i += MAXIMUM_WAIT_OBJECTS )
+    {
+        DWORD count = std::min<DWORD>( MAXIMUM_WAIT_OBJECTS, threads.size() - i );
+        WaitForMultipleObjectsEx( count, &threads[i], true, INFINITE, FALSE );
+    }
+}
+
+bool isTestPort( unsigned port )
+{
+    return (port >= basePort) && (port < basePort + listenPorts);
+}
+
+int addressLength( const SOCKADDR_INET &a )
+{
+    return (a.si_family == AF_INET6) ? sizeof(SOCKADDR_IN6) : sizeof(SOCKADDR_IN);
+}
+
+void setAddressPort( SOCKADDR_INET &a, unsigned port )
+{
+    if( a.si_family == AF_INET6 )
+        a.Ipv6.sin6_port = htons( (u_short) port );
+    else
+        a.Ipv4.sin_port = htons( (u_short) port );
+}
+
+unsigned addressPort( const SOCKADDR_INET &a )
+{
+    return ntohs( (a.si_family == AF_INET6) ? a.Ipv6.sin6_port : a.Ipv4.sin_port );
+}
+
+// without the port
+std::string addressString( const SOCKADDR_INET &a )
+{
+    char buf[INET6_ADDRSTRLEN] = "?";
+
+    if( a.si_family == AF_INET6 )
+        inet_ntop( AF_INET6, (void*) &a.Ipv6.sin6_addr, buf, sizeof(buf) );
+    else if( a.si_family == AF_INET )
+        inet_ntop( AF_INET, (void*) &a.Ipv4.sin_addr, buf, sizeof(buf) );
+
+    return buf;
+}
+
+// a numeric IPv4 or IPv6 address
+bool parseAddress( const char *s, SOCKADDR_INET &a )
+{
+    memset( &a, 0, sizeof(a) );
+
+    if( inet_pton( AF_INET, s, &a.Ipv4.sin_addr ) == 1 )
+    {
+        a.si_family = AF_INET;
+        return true;
+    }
+
+    if( inet_pton( AF_INET6, s, &a.Ipv6.sin6_addr ) == 1 )
+    {
+        a.si_family = AF_INET6;
+        return true;
+    }
+
+    return false;
+}
+
+// an IPv4 peer of a dual-stack socket shows up as ::ffff:a.b.c.d; make
+// it plain IPv4 again so it compares and prints like one
+void unmapAddress( SOCKADDR_INET &a )
+{
+    if( (a.si_family == AF_INET6) && IN6_IS_ADDR_V4MAPPED( &a.Ipv6.sin6_addr ) )
+    {
+        SOCKADDR_INET v4 = {0};
+        v4.si_family = AF_INET;
+        v4.Ipv4.sin_port = a.Ipv6.sin6_port;
+        memcpy( &v4.Ipv4.sin_addr, &a.Ipv6.sin6_addr.s6_addr[12], sizeof(IN_ADDR) );
+        a = v4;
+    }
+}
+
+// server name or numeric address, of the given family if there is a
+// choice, say to match the address we connect from
+SOCKADDR_INET resolveServer( const char* server, ADDRESS_FAMILY family = AF_UNSPEC )
+{
+    SOCKADDR_INET addr;
+    if( parseAddress( server, addr ) )
+        return addr;
+
+    ADDRINFOA hints = {0};
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    PADDRINFOA pai;
+    if( getaddrinfo( server, NULL, &hints, &pai ) != 0 )
+    {
+        fprintf(stderr, "getaddrinfo() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    memset( &addr, 0, sizeof(addr) );
+
+    for( PADDRINFOA p = pai; p != NULL; p=p->ai_next )
+    {
+        if( (p->ai_family == AF_INET) || (p->ai_family == AF_INET6) )
+        {
+            memcpy( &addr, p->ai_addr, p->ai_addrlen );
+            break;
+        }
+    }
+
+    freeaddrinfo( pai );
+
+    if( addr.si_family == AF_UNSPEC )
+    {
+        fprintf(stderr, "no address for %s\n", server);
+        exit(-1);
+    }
+
+    return addr;
+}
+
 void gracefulShutdown( SOCKET s )
 {
     char buf[256];
@@ -143,6 +293,74 @@ bool isConnectionPending( SOCKET ls )
     return rv ? true : false;
 }
 
+// Windows has no SO_BUSY_POLL, so poll the socket ourselves: take
+// whatever has arrived without blocking until the spin budget runs out,
+// then block for the rest
+int busyPollRecv( SOCKET s, char *buf, int len, int budget_usec )
+{
+    const __int64 deadline = qpc() + msec_to_qpc( budget_usec / 1000.0 );
+    int received = 0;
+
+    while( received < len && qpc() < deadline )
+    {
+        u_long avail = 0;
+        if (ioctlsocket(s, FIONREAD, &avail) != 0)
+        {
+            return SOCKET_ERROR;
+        }
+
+        if( avail == 0 )
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        int rv = recv(s, buf + received, std::min<int>( avail, len - received ), 0);
+        if( rv == SOCKET_ERROR || rv == 0 )
+        {
+            return rv;
+        }
+
+        received += rv;
+    }
+
+    if( received < len )
+    {
+        int rv = recv(s, buf + received, len - received, MSG_WAITALL);
+        if( rv == SOCKET_ERROR )
+        {
+            return rv;
+        }
+
+        received += rv;
+    }
+
+    return received;
+}
+
+// receive a whole fan-out or fan-in message
+int recvMessage( SOCKET s, char *buf, int len )
+{
+    if( gtp.busy_poll_usec > 0 )
+        return busyPollRecv( s, buf, len, gtp.busy_poll_usec );
+
+    return recv(s, buf, len, MSG_WAITALL);
+}
+
+// send a message behind a one-byte phase marker, if any, in a single
+// call so Nagle can't hold the message back waiting on the marker's ACK;
+// returns the message bytes sent
+int sendMessage( SOCKET s, const char *phase, char *buf, int len )
+{
+    WSABUF wb[2] = { { 1, (char*) phase }, { (ULONG) len, buf } };
+    DWORD sent;
+
+    if (WSASend(s, phase ? wb : wb + 1, phase ? 2 : 1, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+        return SOCKET_ERROR;
+
+    return sent - (phase ? 1 : 0);
+}
+
 void setSocketBufferSize( SOCKET s, int optname, int size )
 {
     if (setsockopt(s, SOL_SOCKET, optname, (char*) &size, sizeof(size)) != 0)
@@ -167,4 +385,98 @@ void disableNagle( SOCKET s )
         fprintf(stderr, "setsockopt() failed: %d\n", WSAGetLastError());
     }
 }
+
+// the stack's own view of the connection, including its RTT estimate,
+// which comes from timestamps taken in the kernel rather than around
+// our calls; fails before Windows 10 version 1703
+bool getTcpInfo( SOCKET s, TCP_INFO_v0 &info )
+{
+    DWORD version = 0;
+    DWORD bytes;
+
+    return WSAIoctl(s, SIO_TCP_INFO, &version, sizeof(version),
+        &info, sizeof(info), &bytes, NULL, NULL) != SOCKET_ERROR;
+}
+
+void setNonBlocking( SOCKET s )
+{
+    u_long flag = 1;
+    if (ioctlsocket(s, FIONBIO, &flag) != 0)
+    {
+        fprintf(stderr, "ioctlsocket() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+}
+
+// on local, or on every IPv4 address without one; with dualStack an
+// IPv6 listener takes IPv4 connections too
+SOCKET createListener( unsigned port, int backlog = 65535, const SOCKADDR_INET *local = NULL,
+    bool dualStack = false )
+{
+    SOCKET ls;
+
+    SOCKADDR_INET sin = {0};
+    if( local )
+        sin = *local;
+    else
+        sin.si_family = AF_INET;
+    setAddressPort( sin, port );
+
+    if ((ls = socket(sin.si_family,SOCK_STREAM,0)) == INVALID_SOCKET)
+    {
+        fprintf(stderr, "socket() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    if( dualStack && (sin.si_family == AF_INET6) )
+    {
+        DWORD off = 0;
+        setsockopt( ls, IPPROTO_IPV6, IPV6_V6ONLY, (char*) &off, sizeof(off) );
+    }
+
+    if (bind(ls, (SOCKADDR*) &sin, addressLength(sin)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "bind() %s port %u failed: %d\n", addressString(sin).c_str(), port, WSAGetLastError());
+        exit(-1);
+    }
+
+    // plain SOMAXCONN leaves the backlog up to the OS; ask for the
+    // largest one so mass reconnects don't overflow into SYN retries,
+    // unless overflowing is the point
+    if (listen(ls, SOMAXCONN_HINT(backlog)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "listen() failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+
+    return ls;
+}
+
+void applySocketOptions( SOCKET s )
+{
+    if( gtp.nagle == false )
+        disableNagle(s);
+
+    if( gtp.send_buffer >= 0 )
+        setSocketBufferSize(s, SO_SNDBUF, gtp.send_buffer );
+
+    if( gtp.recv_buffer >= 0 )
+        setSocketBufferSize(s, SO_RCVBUF, gtp.recv_buffer );
+}
+
+// client side: connect from localAddress, if one was given
+void bindSourceAddress( SOCKET s )
+{
+    if( localAddress.si_family == AF_UNSPEC )
+        return;
+
+    SOCKADDR_INET local = localAddress;
+    setAddressPort( local, 0 );
+
+    if (bind(s, (SOCKADDR*) &local, addressLength(local)) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "bind() to local address failed: %d\n", WSAGetLastError());
+        exit(-1);
+    }
+}
 #endif // __INCAST_UTILS_H
@@ -0,0 +1,121 @@
+// Incast
+//
+// Copyright (c) Microsoft Corporation
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED *AS IS*, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef _INCAST_WARMUP_H
+#define _INCAST_WARMUP_H
+
+// Adaptive warm-up.  Instead of a fixed WARMUP_ITERS, the server keeps
+// running warm-up volleys until the median volley latency of the last
+// WARMUP_WINDOW volleys is within WARMUP_TOLERANCE of the window before
+// it, or until gtp.warmup_cap volleys.  Slow start and receive buffer
+// autotuning have settled by then.
+//
+// Clients can't count to a number nobody knows in advance, so each
+// adaptive warm-up fan-out is preceded by a WARMUP_VOLLEY byte, and the
+// measured phase by a lone WARMUP_DONE byte.
+
+const int WARMUP_WINDOW = 100;
+const double WARMUP_TOLERANCE = 0.05;
+
+const char WARMUP_VOLLEY = 'W';
+const char WARMUP_DONE = 'M';
+
+struct WarmupState
+{
+    // the previous volley, one slot per serverThread
+    std::vector<__int64> start;
+    std::vector<__int64> stop;
+
+    std::vector<double> latency;    // usec, one per volley so far
+    bool done;
+    bool stable;
+
+    void reset( int clients )
+    {
+        start.assign( clients, 0 );
+        stop.assign( clients, 0 );
+        latency.clear();
+        done = false;
+        stable = false;
+    }
+} warmup;
+
+double windowMedian( const std::vector<double> &v, size_t end )
+{
+    std::vector<double> w( v.begin() + (end - WARMUP_WINDOW), v.begin() + end );
+    std::nth_element( w.begin(), w.begin() + WARMUP_WINDOW / 2, w.end() );
+    return w[WARMUP_WINDOW / 2];
+}
+
+// run by the last serverThread to reach the barrier before a warm-up
+// volley, while the others wait
+void warmupCheck()
+{
+    // the volley that just finished; the first call has none
+    if( warmup.stop[0] != 0 )
+    {
+        __int64 first = *std::min_element( warmup.start.begin(), warmup.start.end() );
+        __int64 last = *std::max_element( warmup.stop.begin(), warmup.stop.end() );
+        warmup.latency.push_back( (last - first) * 1.0e6 / freq );
+    }
+
+    const size_t volleys = warmup.latency.size();
+
+    if( volleys >= 2 * WARMUP_WINDOW )
+    {
+        double recent = windowMedian( warmup.latency, volleys );
+        double before = windowMedian( warmup.latency, volleys - WARMUP_WINDOW );
+
+        warmup.stable = fabs( recent - before ) <= WARMUP_TOLERANCE * before;
+    }
+
+    warmup.done = warmup.stable || (volleys >= (size_t) gtp.warmup_cap);
+}
+
+void reportWarmup()
+{
+    if( gtp.warmup_cap <= 0 )
+        return;
+
+    const size_t volleys = warmup.latency.size();
+
+    printf( "\nWarm-up:\n" );
+    printf( "\tvolleys:              %10d\n", (int) volleys );
+    printf( "\tsteady state:         %10s\n", warmup.stable ? "yes" : "no (cap)" );
+
+    // drift from the first window to the last
+    if( volleys >= WARMUP_WINDOW )
+    {
+        double first = windowMedian( warmup.latency, WARMUP_WINDOW );
+        double last = windowMedian( warmup.latency, volleys );
+
+        printf( "\tfirst median usec:    %10.3f\n", first );
+        printf( "\tlast median usec:     %10.3f\n", last );
+        printf( "\tdrift:                %9.1f%%\n", 100 * (last - first) / first );
+    }
+}
+
+#endif // _INCAST_WARMUP_H